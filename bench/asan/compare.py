@@ -0,0 +1,61 @@
+# Builds `workload.cpp` plain, with easyspot debug and with asan, then runs them side by side
+# usage: python3 compare.py [rounds]    (the compiler is taken from $CXX, `c++` by default)
+
+import os
+import subprocess
+import sys
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+CXX = os.environ.get('CXX', 'c++')
+COMMON_FLAGS = ['-std=c++20', '-O2', '-g']
+
+BUILDS = [
+  ('plain', []),
+  ('easyspot', ['-DEASYSPOT_DEBUG']),
+  ('asan', ['-fsanitize=address', '-fno-omit-frame-pointer']),
+]
+
+
+def build(name, flags):
+  out = os.path.join(HERE, f'workload_{name}')
+  cmd = [CXX, *COMMON_FLAGS, *flags, os.path.join(HERE, 'workload.cpp'), '-o', out]
+  subprocess.run(cmd, check=True)
+  return out
+
+
+def run(binary, rounds):
+  start = time.perf_counter()
+  proc = subprocess.Popen([binary, str(rounds)], stdout=subprocess.PIPE)
+  # wait4 gives the rusage of this child alone, RUSAGE_CHILDREN would keep the max of all of them
+  _, status, usage = os.wait4(proc.pid, 0)
+  elapsed = time.perf_counter() - start
+  output = proc.stdout.read().decode().strip()
+
+  if status != 0:
+    sys.exit(f'{binary} failed with status {status}')
+
+  # ru_maxrss is in KiB on linux
+  return elapsed, usage.ru_maxrss, output
+
+
+def main():
+  rounds = int(sys.argv[1]) if len(sys.argv) > 1 else 200
+  results = []
+
+  for name, flags in BUILDS:
+    binary = build(name, flags)
+    results.append((name, *run(binary, rounds)))
+
+  _, base_time, base_rss, base_output = results[0]
+  print(f'{"build":<10} {"seconds":>9} {"slowdown":>9} {"max rss":>12} {"overhead":>9}')
+
+  for name, elapsed, rss, output in results:
+    if output != base_output:
+      sys.exit(f'{name} computed a different checksum, the builds are not comparable')
+
+    print(f'{name:<10} {elapsed:>9.3f} {elapsed / base_time:>8.2f}x {rss / 1024:>8.1f} MiB {rss / base_rss:>8.2f}x')
+
+
+if __name__ == '__main__':
+  main()
@@ -0,0 +1,58 @@
+// Block/seq workload shared by the three builds of `compare.py`: plain, easyspot debug and asan
+// usage: workload [rounds]
+
+#include "../../lib.hpp"
+
+#include <random>
+
+
+int main(int argc, char** argv)
+{
+    size_t rounds = argc > 1 ? strtoull(argv[1], nullptr, 10) : 200;
+
+    std::mt19937 rng(7);
+    std::vector<seq<uint32_t>> live;
+    uint64_t checksum = 0;
+
+    for (size_t round = 0; round < rounds; round++)
+    {
+        // churn, keeps about a thousand sequences alive like a steady state service
+        for (auto i = 0; i < 1000; i++)
+        {
+            if (live.size() < 1000 || rng() % 2 == 0)
+            {
+                live.push_back(seq<uint32_t>(1 + rng() % 256));
+                continue;
+            }
+
+            auto idx = rng() % live.size();
+            live[idx].drop();
+            live[idx] = live.back();
+            live.pop_back();
+        }
+
+        // indexed accesses dominate real workloads, way more than allocations
+        for (auto& s : live)
+        {
+            auto cap = s.capacity();
+            for (size_t i = 0; i < cap; i++)
+                s[i] = (uint32_t)(i * round);
+
+            for (size_t i = 0; i < cap; i++)
+                checksum += s[i];
+        }
+
+        // and some accesses through refs, which is where debug mode checks liveness
+        for (auto i = 0; i < 100; i++)
+        {
+            auto r = live[rng() % live.size()].nth(0);
+            checksum += *r;
+        }
+    }
+
+    for (auto& s : live)
+        s.drop();
+
+    printf("%llu\n", (unsigned long long)checksum);
+    return 0;
+}
@@ -0,0 +1,70 @@
+// Memory cost of tiny blocks, to compare the block header modes on small-object-heavy heaps
+// build with and without `-DEASYSPOT_COMPACT_HEADER` (and `-DEASYSPOT_POOL`) or with `-DEASYSPOT_HEADERLESS`, rows carry the mode
+// usage: header [blocks per size] > results.csv
+
+#include "../../lib.hpp"
+
+#include <sys/wait.h>
+
+
+#if defined(EASYSPOT_HEADERLESS)
+    constexpr cstring BENCH_BACKEND = "pagemap";
+    constexpr size_t BENCH_HEADER_BYTES = 0;
+#elif defined(EASYSPOT_POOL)
+    constexpr cstring BENCH_BACKEND = "pool";
+#else
+    constexpr cstring BENCH_BACKEND = "new[]";
+#endif
+
+#ifndef EASYSPOT_HEADERLESS
+    constexpr size_t BENCH_HEADER_BYTES = sizeof(BlockHeader);
+#endif
+
+/// Runs in a forked child, so every payload starts from a heap that never saw the previous ones
+double bytes_per_block(size_t payload, size_t count)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+        return 0;
+
+    if (fork() == 0)
+    {
+        // the pointer array is touched before measuring, only the blocks must count
+        std::vector<OwningPointer> live(count, nullptr);
+        auto before = es::process_rss_bytes();
+
+        for (size_t i = 0; i < count; i++)
+        {
+            live[i] = block(payload).bptr;
+            live[i][0] = 1;
+        }
+
+        auto result = (double)(es::process_rss_bytes() - before) / count;
+        auto written = write(fds[1], &result, sizeof(result));
+        _exit(written == sizeof(result) ? 0 : 1);
+    }
+
+    double result = 0;
+    if (read(fds[0], &result, sizeof(result)) != sizeof(result))
+        result = 0;
+
+    wait(nullptr);
+    close(fds[0]);
+    close(fds[1]);
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    size_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+    size_t const payloads[] = { 4, 8, 12, 16, 20, 24, 32, 48, 64 };
+
+    printf("header_bytes,backend,payload,blocks,bytes_per_block\n");
+    for (auto payload : payloads)
+        printf(
+            "%zu,%s,%zu,%zu,%.2f\n",
+            BENCH_HEADER_BYTES, BENCH_BACKEND, payload, count, bytes_per_block(payload, count)
+        );
+
+    return 0;
+}
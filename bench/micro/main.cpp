@@ -0,0 +1,239 @@
+// Microbenchmarks of the hot operations of the library
+// the seq_iterate and seq_with_span rows are per element, like seq_index
+// build once plain and once with `-DEASYSPOT_DEBUG` to compare the modes, rows carry the mode
+// usage: micro [csv|json] > results
+
+#include "../../lib.hpp"
+
+#include <chrono>
+#include <string>
+
+
+#ifdef EASYSPOT_DEBUG
+    constexpr cstring BENCH_MODE = "debug";
+#else
+    constexpr cstring BENCH_MODE = "release";
+#endif
+
+struct BenchResult
+{
+    cstring name;
+    size_t size;
+    size_t live;
+    size_t iterations;
+    double ns_per_op;
+};
+
+std::vector<BenchResult> results;
+
+
+/// Keeps the compiler from deleting the computation of `value`
+template<typename T>
+inline void keep(T const& value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/// Forces memory to be read again after this point, so loads are not hoisted out of loops
+inline void clobber()
+{
+    asm volatile("" : : : "memory");
+}
+
+/// Runs `body(iterations)` with growing iteration counts until it takes long enough to be measured
+template<typename BodyF>
+void bench(cstring name, size_t size, size_t live, BodyF body)
+{
+    size_t iterations = 1;
+    double elapsed = 0;
+
+    while (true)
+    {
+        auto start = std::chrono::steady_clock::now();
+        body(iterations);
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (elapsed >= 0.05 || iterations >= ((size_t)1 << 30))
+            break;
+
+        iterations *= elapsed < 0.005 ? 10 : 2;
+    }
+
+    results.push_back(BenchResult {
+        .name = name, .size = size, .live = live,
+        .iterations = iterations, .ns_per_op = elapsed * 1e9 / iterations
+    });
+}
+
+/// Blocks kept alive during a benchmark, in debug mode they all sit in the registry
+std::vector<block> make_live_set(size_t count)
+{
+    std::vector<block> live;
+    live.reserve(count);
+    for (size_t i = 0; i < count; i++)
+        live.push_back(block(32));
+
+    return live;
+}
+
+void drop_live_set(std::vector<block>& live)
+{
+    for (auto& b : live)
+        b.drop();
+}
+
+void print_csv()
+{
+    printf("mode,name,size,live,iterations,ns_per_op\n");
+    for (auto& r : results)
+        printf("%s,%s,%zu,%zu,%zu,%.3f\n", BENCH_MODE, r.name, r.size, r.live, r.iterations, r.ns_per_op);
+}
+
+void print_json()
+{
+    printf("[\n");
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        auto& r = results[i];
+        printf(
+            "  {\"mode\": \"%s\", \"name\": \"%s\", \"size\": %zu, \"live\": %zu, \"iterations\": %zu, \"ns_per_op\": %.3f}%s\n",
+            BENCH_MODE, r.name, r.size, r.live, r.iterations, r.ns_per_op, i + 1 < results.size() ? "," : ""
+        );
+    }
+    printf("]\n");
+}
+
+int main(int argc, char** argv)
+{
+    auto format = std::string(argc > 1 ? argv[1] : "csv");
+    if (format != "csv" && format != "json")
+    {
+        printf("usage: %s [csv|json]\n", argv[0]);
+        return 1;
+    }
+
+    size_t const sizes[] = { 16, 256, 4096, 65536 };
+    size_t const lives[] = { 0, 100, 10000 };
+
+    for (auto live_count : lives)
+    {
+        auto live = make_live_set(live_count);
+
+        for (auto size : sizes)
+            bench("block_alloc_drop", size, live_count, [&](size_t n)
+            {
+                for (size_t i = 0; i < n; i++)
+                {
+                    auto b = block(size);
+                    keep(b.bptr);
+                    b.drop();
+                }
+            });
+
+        // a sparse 64 MiB table, only one element per MiB is ever written
+        size_t const table = 64 << 20;
+        bench("seq_memset_sparse", table, live_count, [&](size_t n)
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                auto s = seq<uint8_t>(table);
+                memset(s.b.bptr, 0, table);
+                for (size_t j = 0; j < table; j += 1 << 20)
+                    s[j] = 1;
+
+                keep(s.b.bptr);
+                s.drop();
+            }
+        });
+
+        bench("seq_zeroed_sparse", table, live_count, [&](size_t n)
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                auto s = seq<uint8_t>(table, zeroed);
+                for (size_t j = 0; j < table; j += 1 << 20)
+                    s[j] = 1;
+
+                keep(s.b.bptr);
+                s.drop();
+            }
+        });
+
+        for (auto size : sizes)
+        {
+            auto s = seq<uint32_t>(size / sizeof(uint32_t));
+            for (size_t i = 0; i < s.capacity(); i++)
+                s[i] = i;
+
+            bench("seq_index", size, live_count, [&](size_t n)
+            {
+                uint32_t sum = 0;
+                auto cap = s.capacity();
+                for (size_t i = 0; i < n; i++)
+                    sum += s[i % cap];
+
+                keep(sum);
+            });
+
+            bench("seq_iterate", size, live_count, [&](size_t n)
+            {
+                uint32_t sum = 0;
+                for (size_t done = 0; done < n; done += s.capacity())
+                    for (auto x : s)
+                        sum += x;
+
+                keep(sum);
+            });
+
+            bench("seq_with_span", size, live_count, [&](size_t n)
+            {
+                uint32_t sum = 0;
+                for (size_t done = 0; done < n; done += s.capacity())
+                    s.with_span(0, s.capacity(), [&](uint32_t* first, size_t count)
+                    {
+                        for (size_t i = 0; i < count; i++)
+                            sum += first[i];
+                    });
+
+                keep(sum);
+            });
+
+            s.drop();
+        }
+
+        auto b = block(sizeof(uint64_t));
+        auto r = b.as_ref<uint64_t>();
+        *r = 1;
+
+        bench("ref_deref", sizeof(uint64_t), live_count, [&](size_t n)
+        {
+            uint64_t sum = 0;
+            for (size_t i = 0; i < n; i++)
+            {
+                sum += *r;
+                clobber();
+            }
+
+            keep(sum);
+        });
+
+        bench("as_ref", sizeof(uint64_t), live_count, [&](size_t n)
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                auto r = b.as_ref<uint64_t>();
+                keep(r.bptr);
+            }
+        });
+
+        b.drop();
+        drop_live_set(live);
+    }
+
+    if (format == "json")
+        print_json();
+    else
+        print_csv();
+
+    return 0;
+}
@@ -0,0 +1,126 @@
+// Latency of the registry checks as the number of live blocks grows
+// usage: scaling [max_live] > curve.csv
+//
+// prints p50/p99/p999 of `check_use` and `check_drop` for 10, 100, ... up to `max_live` (default 10M)
+// live blocks, then the log-log slope between the points, which tells the complexity of the backend
+
+#define EASYSPOT_DEBUG
+#include "../../lib.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <random>
+
+
+/// Stops sampling a point once it took this long, the big sizes can't afford many samples
+constexpr double POINT_BUDGET_SECONDS = 1.0;
+constexpr size_t MAX_SAMPLES = 100000;
+constexpr size_t MIN_SAMPLES = 50;
+
+struct Percentiles
+{
+    size_t samples;
+    double p50;
+    double p99;
+    double p999;
+};
+
+Percentiles percentiles_of(std::vector<double>& ns)
+{
+    std::sort(ns.begin(), ns.end());
+    auto at = [&](double q) { return ns[std::min(ns.size() - 1, (size_t)(q * ns.size()))]; };
+    return Percentiles { .samples = ns.size(), .p50 = at(0.5), .p99 = at(0.99), .p999 = at(0.999) };
+}
+
+inline double elapsed_ns(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+/// Runs `sample()` until the budget or the sample cap is hit, `sample` returns one latency in ns
+template<typename SampleF>
+Percentiles measure(SampleF sample)
+{
+    std::vector<double> ns;
+    auto start = std::chrono::steady_clock::now();
+
+    while (ns.size() < MAX_SAMPLES)
+    {
+        ns.push_back(sample());
+        if (ns.size() >= MIN_SAMPLES && elapsed_ns(start) > POINT_BUDGET_SECONDS * 1e9)
+            break;
+    }
+
+    return percentiles_of(ns);
+}
+
+int main(int argc, char** argv)
+{
+    size_t max_live = argc > 1 ? strtoull(argv[1], nullptr, 10) : 10000000;
+
+    std::mt19937_64 rng(42);
+    std::vector<block> live;
+    std::vector<size_t> counts;
+    std::vector<Percentiles> use_curve;
+    std::vector<Percentiles> drop_curve;
+
+    printf("live,op,samples,p50_ns,p99_ns,p999_ns\n");
+
+    for (size_t count = 10; count <= max_live; count *= 10)
+    {
+        while (live.size() < count)
+            live.push_back(block(16));
+
+        auto use = measure([&]
+        {
+            auto r = live[rng() % live.size()].as_ref<uint64_t>();
+            auto start = std::chrono::steady_clock::now();
+            r.check_use();
+            return elapsed_ns(start);
+        });
+
+        auto drop = measure([&]
+        {
+            // the whole drop is timed, its check is the only part that depends on the live count.
+            // the block is replaced right away, so the live count stays the same
+            auto& b = live[rng() % live.size()];
+            auto start = std::chrono::steady_clock::now();
+            b.drop();
+            auto ns = elapsed_ns(start);
+
+            b = block(16);
+            return ns;
+        });
+
+        printf("%zu,check_use,%zu,%.1f,%.1f,%.1f\n", count, use.samples, use.p50, use.p99, use.p999);
+        printf("%zu,check_drop,%zu,%.1f,%.1f,%.1f\n", count, drop.samples, drop.p50, drop.p99, drop.p999);
+        fflush(stdout);
+
+        counts.push_back(count);
+        use_curve.push_back(use);
+        drop_curve.push_back(drop);
+    }
+
+    // slope of log(p50) over log(live) between the two largest points: ~0 is O(1), ~1 is O(n),
+    // a small positive slope that shrinks as n grows is O(log n)
+    auto classify = [&](cstring op, std::vector<Percentiles> const& curve)
+    {
+        if (curve.size() < 2)
+            return;
+
+        auto n = curve.size();
+        auto slope = std::log(std::max(curve[n - 1].p50, 1.0) / std::max(curve[n - 2].p50, 1.0))
+            / std::log((double)counts[n - 1] / counts[n - 2]);
+
+        auto verdict = slope < 0.15 ? "O(1)" : slope < 0.6 ? "O(log n)" : "O(n)";
+        fprintf(stderr, "%s: slope %.2f -> %s\n", op, slope, verdict);
+    };
+
+    classify("check_use", use_curve);
+    classify("check_drop", drop_curve);
+
+    for (auto& b : live)
+        b.drop();
+
+    return 0;
+}
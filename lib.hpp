@@ -3,12 +3,33 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <string.h>
 #include <execinfo.h>
 #include <cxxabi.h>
 #include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <vector>
 #include <iostream>
+#include <iterator>
+#include <type_traits>
 #include <memory>
+#include <mutex>
+#include <atomic>
+#include <new>
+#include <algorithm>
+#include <thread>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <condition_variable>
+#include <chrono>
+#include <system_error>
+#include <stdexcept>
 
 
 #ifdef EASYSPOT_DEBUG
@@ -32,13 +53,9 @@
 #endif
 
 
-/// Compile with `-g to get symbol names`
-void print_stacktrace()
+/// Prints frames captured with `backtrace()`, outermost first
+void print_frames(void** addrlist, int addrlen)
 {
-    const int max_frames = 64;
-    void* addrlist[max_frames];
-
-    auto addrlen = backtrace(addrlist, max_frames);
     if (addrlen == 0)
     {
         std::cout << " ↳ <No stacktrace found, possibly corrupt>\n";
@@ -48,6 +65,15 @@ void print_stacktrace()
     auto symbols = backtrace_symbols(addrlist, addrlen);
     auto idx_of_main = -1;
 
+    // stacks of spawned threads have no main, in that case every frame is printed
+    auto has_main = false;
+    for (auto i = 0; i < addrlen; i++)
+        if (strstr(symbols[i], "(main+") != nullptr)
+            has_main = true;
+
+    if (!has_main)
+        idx_of_main = 1;
+
     // usual format to parse: "path(mangled_name+offset) [address]"
     for (auto i = 1; i < addrlen; i++)
     {
@@ -118,6 +144,46 @@ void print_stacktrace()
 }
 
 
+/// Compile with `-g to get symbol names`
+void print_stacktrace()
+{
+    const int max_frames = 64;
+    void* addrlist[max_frames];
+
+    auto addrlen = backtrace(addrlist, max_frames);
+    print_frames(addrlist, addrlen);
+}
+
+
+/// Names a code address as `function+offset` when the symbol is exported (link with `-rdynamic`),
+/// otherwise as `module(+offset)`
+std::string describe_site(void* site)
+{
+    Dl_info info;
+    char buffer[64];
+    if (site == nullptr || dladdr(site, &info) == 0)
+    {
+        snprintf(buffer, sizeof(buffer), "%p", site);
+        return buffer;
+    }
+
+    // without a symbol the module offset can still be fed to addr2line
+    if (info.dli_sname == nullptr)
+    {
+        snprintf(buffer, sizeof(buffer), "(+0x%zx)", (size_t)((uint8_t*)site - (uint8_t*)info.dli_fbase));
+        return std::string(info.dli_fname) + buffer;
+    }
+
+    int status;
+    auto demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+    std::string name = status == 0 ? demangled : info.dli_sname;
+    free(demangled);
+
+    snprintf(buffer, sizeof(buffer), "+0x%zx", (size_t)((uint8_t*)site - (uint8_t*)info.dli_saddr));
+    return name + buffer;
+}
+
+
 void panic()
 {
     print_stacktrace();
@@ -128,180 +194,4404 @@ void panic()
 using cstring = char const*;
 
 /// Do not use this directly, represents a pointer that has its block size stored
-/// in the sizeof(size_t) previous bytes of the pointer (ptr - sizeof(size_t))
+/// in the header right before the pointer (ptr - sizeof(BlockHeader)), or in the page map with `EASYSPOT_HEADERLESS`
 using OwningPointer = uint8_t*;
 
 
-// TODO: make this thread safe, remember different threads can use the same memory,
-//       so i can't make this thread local but must be shared among all threads
-#ifdef EASYSPOT_DEBUG
-    struct RegistryRecord
-    {
-        OwningPointer block;
-        uint16_t generation;
-    };
+/// Kernel id of the calling thread, cached after the first call
+uint32_t current_thread_id()
+{
+    static thread_local uint32_t tid = 0;
+    if (tid == 0)
+        tid = (uint32_t)syscall(SYS_gettid);
 
-    // TODO: make this actually performant and use data oriented design
-    // TODO: implement generation logic + pointer flagging for local generation
-    // TODO: implement last access tick to track elapsed time between last block access and block drop
-    std::vector<RegistryRecord> debug_mem_registry;
-#endif
+    return tid;
+}
 
 
-/// A non-owning pointer (it has not clue about the size of the pointed block)
-template<typename PointeeT>
-struct ref
+/// Layout of a trace file: a `TraceHeader` followed by `capacity` fixed size events used as a ring.
+/// These are always visible so offline tools can read traces without enabling the recording mode
+enum TraceKind : uint8_t
 {
-    PointeeT* bptr;
+    TRACE_ALLOC = 1,
+    TRACE_DROP = 2,
+    TRACE_USE = 3,
+};
 
-    ref(uint8_t* ptr)
-    {
-        bptr = (PointeeT*)ptr;
-    }
-    
-    PointeeT& operator*()
-    {
-        check_use();
-        return *bptr;
-    }
-    
-    PointeeT* operator->()
-    {
-        check_use();
-        return bptr;
-    }
+struct TraceEvent
+{
+    uint64_t tick;
+    uint64_t address;
+    uint64_t size;
+    uint32_t thread : 24;
+    uint32_t kind : 8;
+    uint32_t stack_id;
+};
 
-    #ifdef EASYSPOT_DEBUG
-        inline void check_use()
+static_assert(sizeof(TraceEvent) == 32, "trace events must stay 32 bytes");
+
+struct TraceHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t event_size;
+    uint64_t capacity;
+    uint64_t ticks_per_second;
+    uint32_t pid;
+    uint32_t thread;
+    // total number of events ever written, the slot of the next event is `head % capacity`
+    volatile uint64_t head;
+};
+
+constexpr char TRACE_MAGIC[8] = "ESTRACE";
+constexpr uint32_t TRACE_VERSION = 1;
+
+
+// recording mode, every block construction and drop (and with `EASYSPOT_TRACE_USES` every `check_use`)
+// writes one `TraceEvent` in a per thread ring file, which is mmap'd shared so it survives a crash.
+// the hot path never allocates nor prints, it's a timestamp read plus a 32 bytes store
+#ifdef EASYSPOT_TRACE
+    #ifndef EASYSPOT_TRACE_DIR
+        #define EASYSPOT_TRACE_DIR "."
+    #endif
+
+    #ifndef EASYSPOT_TRACE_CAPACITY
+        // events per thread, the ring overwrites the oldest ones
+        #define EASYSPOT_TRACE_CAPACITY (1 << 20)
+    #endif
+
+    #if defined(__x86_64__) || defined(__i386__)
+        #include <x86intrin.h>
+
+        inline uint64_t trace_tick()
+        {
+            return __rdtsc();
+        }
+
+        /// Measured once, so the reader can convert ticks to time
+        uint64_t trace_ticks_per_second()
         {
-            for (auto i = 0; i < debug_mem_registry.size(); i++)
+            static uint64_t cached = 0;
+            if (cached != 0)
+                return cached;
+
+            timespec start_ts, now_ts;
+            clock_gettime(CLOCK_MONOTONIC, &start_ts);
+            auto start_tick = __rdtsc();
+            uint64_t elapsed_ns = 0;
+
+            // spinning for 1ms is enough to get a stable ratio
+            while (elapsed_ns < 1000000)
             {
-                auto record = debug_mem_registry[i];
-                auto record_block_size = ((size_t*)(record.block - sizeof(size_t)))[0];
-                if ((uint8_t*)bptr >= record.block && (uint8_t*)bptr <= record.block + record_block_size)
-                    return;
+                clock_gettime(CLOCK_MONOTONIC, &now_ts);
+                elapsed_ns = (now_ts.tv_sec - start_ts.tv_sec) * 1000000000ull + now_ts.tv_nsec - start_ts.tv_nsec;
             }
 
-            PANIC("Use of dead reference");
+            cached = (__rdtsc() - start_tick) * 1000000000ull / elapsed_ns;
+            return cached;
         }
     #else
-        inline void check_use()
+        inline uint64_t trace_tick()
         {
+            timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+        }
 
+        uint64_t trace_ticks_per_second()
+        {
+            return 1000000000ull;
         }
     #endif
-};
 
+    struct TraceRing
+    {
+        TraceHeader* header = nullptr;
+        TraceEvent* events = nullptr;
+        size_t mapped_bytes = 0;
+        bool failed = false;
 
-/// Untyped owning pointer
-/// contains the actual pointer to the block and the size of the block
-struct block
-{
-    OwningPointer bptr;
+        ~TraceRing()
+        {
+            // the file stays on disk, unmapping only drops our view of it
+            if (header != nullptr)
+                munmap(header, mapped_bytes);
+        }
 
-    block(size_t size)
-    {
-        // TODO: consider using uint32_t instead
-        bptr = new uint8_t[sizeof(size_t) + size];
+        /// Creates the ring file of the calling thread, only runs on its first event
+        bool open()
+        {
+            if (failed)
+                return false;
 
-        // storing the size of the block in the first bytes
-        // and advancing the pointer by default
-        ((size_t*)bptr)[0] = size;
-        bptr += sizeof(size_t);
+            // the path is built on the stack, nothing here may allocate
+            char path[512];
+            snprintf(
+                path, sizeof(path), "%s/easyspot-%d-%u.trace",
+                EASYSPOT_TRACE_DIR, (int)getpid(), current_thread_id()
+            );
 
-        #ifdef EASYSPOT_DEBUG
-            debug_mem_registry.push_back(RegistryRecord { .block = bptr, .generation = 0 });
-        #endif
-    }
+            mapped_bytes = sizeof(TraceHeader) + (size_t)EASYSPOT_TRACE_CAPACITY * sizeof(TraceEvent);
+            auto fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0 || ftruncate(fd, mapped_bytes) != 0)
+            {
+                if (fd >= 0)
+                    close(fd);
 
-    ~block()
+                failed = true;
+                return false;
+            }
+
+            auto mapping = mmap(nullptr, mapped_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            close(fd);
+
+            if (mapping == MAP_FAILED)
+            {
+                failed = true;
+                return false;
+            }
+
+            header = (TraceHeader*)mapping;
+            events = (TraceEvent*)(header + 1);
+
+            for (auto i = 0; i < 8; i++)
+                header->magic[i] = TRACE_MAGIC[i];
+
+            header->version = TRACE_VERSION;
+            header->event_size = sizeof(TraceEvent);
+            header->capacity = EASYSPOT_TRACE_CAPACITY;
+            header->ticks_per_second = trace_ticks_per_second();
+            header->pid = getpid();
+            header->thread = current_thread_id();
+            header->head = 0;
+            return true;
+        }
+    };
+
+    static thread_local TraceRing trace_ring;
+
+    /// Without `EASYSPOT_TRACE_STACKS` the stack id is a hash of the immediate caller only,
+    /// a full backtrace costs microseconds which is way over the budget of an event
+    inline uint32_t trace_stack_id(void* caller)
     {
-        // not allowed to deallocate internal block
+        #ifdef EASYSPOT_TRACE_STACKS
+            void* frames[8];
+            auto count = backtrace(frames, 8);
+        #else
+            void* frames[1] = { caller };
+            auto count = 1;
+        #endif
+
+        // fnv-1a over the return addresses
+        uint32_t hash = 2166136261u;
+        for (auto i = 0; i < count; i++)
+        {
+            auto address = (uint64_t)frames[i];
+            for (auto j = 0; j < 8; j++)
+            {
+                hash ^= (uint8_t)(address >> (j * 8));
+                hash *= 16777619u;
+            }
+        }
+
+        return hash;
     }
 
-    void drop()
+    inline void trace_record(TraceKind kind, void* address, uint64_t size, uint32_t stack_id)
     {
-        check_drop();
-        auto actual_ptr = bptr - sizeof(size_t);
-        delete[] actual_ptr;
+        if (trace_ring.events == nullptr && !trace_ring.open())
+            return;
+
+        auto header = trace_ring.header;
+        auto head = header->head;
+        auto& event = trace_ring.events[head % header->capacity];
+
+        event.tick = trace_tick();
+        event.address = (uint64_t)address;
+        event.size = size;
+        event.thread = current_thread_id();
+        event.kind = kind;
+        event.stack_id = stack_id;
+
+        // publishing the head after the event, so a crash never exposes a torn slot as written
+        __atomic_store_n(&header->head, head + 1, __ATOMIC_RELEASE);
     }
 
-    #ifdef EASYSPOT_DEBUG
-        inline void check_drop()
-        {
-            for (auto i = 0; i < debug_mem_registry.size(); i++)
-                if (bptr == debug_mem_registry[i].block)
-                {
-                    std::swap(debug_mem_registry[i], debug_mem_registry.back());
-                    debug_mem_registry.pop_back();
-                    return;
-                }
-            
-            PANIC("Drop of dead block. Maybe double drop?");
-        }
+    #define TRACE(kind, ptr, size) trace_record(kind, ptr, size, trace_stack_id(__builtin_return_address(0)))
+
+    #ifdef EASYSPOT_TRACE_USES
+        #define TRACE_USE(ptr) TRACE(TRACE_USE, ptr, 0)
     #else
-        inline void check_drop()
+        #define TRACE_USE(ptr) ;
+    #endif
+#else
+    #define TRACE(kind, ptr, size) ;
+    #define TRACE_USE(ptr) ;
+#endif
+
+
+inline size_t page_size()
+{
+    static size_t const page = sysconf(_SC_PAGESIZE);
+    return page;
+}
+
+inline size_t page_round(size_t bytes)
+{
+    return (bytes + page_size() - 1) & ~(page_size() - 1);
+}
+
+/// Anonymous mapping aligned to `align` (a power of two), a bigger one is mapped and trimmed when
+/// the page alignment isn't enough. `flags` are added to the mmap ones. Returns `nullptr` on failure
+inline void* map_aligned(size_t bytes, size_t align, int flags = 0)
+{
+    auto reserved = align > page_size() ? bytes + align : bytes;
+    auto mapping = (uint8_t*)mmap(nullptr, reserved, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+    if (mapping == MAP_FAILED)
+        return nullptr;
+
+    auto ptr = (uint8_t*)(((uintptr_t)mapping + align - 1) & ~(uintptr_t)(align - 1));
+    if (ptr != mapping)
+        munmap(mapping, ptr - mapping);
+
+    if (ptr + bytes != mapping + reserved)
+        munmap(ptr + bytes, mapping + reserved - ptr - bytes);
+
+    return ptr;
+}
+
+
+// huge pages mode, pool regions and arena chunks are asked as explicit huge pages (MAP_HUGETLB),
+// which only works when the system has reserved some (vm.nr_hugepages). otherwise they are mapped
+// 2 MiB aligned and advised to become transparent huge pages, which the kernel may or may not do:
+// `es::heap_page_stats()` tells how much actually is. the scavenger gives nothing back in this mode,
+// a pool span is only a piece of a huge page
+#ifdef EASYSPOT_HUGE_PAGES
+    constexpr size_t HEAP_PAGE_SIZE = 2 * 1024 * 1024;
+#else
+    constexpr size_t HEAP_PAGE_SIZE = 4096;
+#endif
+
+/// Pool regions and arena chunks, so the stats know which mappings are the heap
+struct HeapMapping
+{
+    uintptr_t start;
+    size_t bytes;
+};
+
+std::vector<HeapMapping> heap_mappings;
+std::mutex heap_mappings_lock;
+
+inline size_t heap_round(size_t bytes)
+{
+    auto unit = std::max(HEAP_PAGE_SIZE, page_size());
+    return (bytes + unit - 1) & ~(unit - 1);
+}
+
+/// `bytes` must be a multiple of `heap_round`, returns `nullptr` on failure
+inline void* map_heap(size_t bytes, size_t align)
+{
+    #ifdef EASYSPOT_HUGE_PAGES
+        // explicit huge pages are aligned to their size by the kernel, so trimming keeps whole huge pages
+        auto mapping = map_aligned(bytes, align, MAP_HUGETLB);
+        if (mapping == nullptr)
         {
-            
+            mapping = map_aligned(bytes, std::max(align, HEAP_PAGE_SIZE));
+            if (mapping == nullptr)
+                return nullptr;
+
+            madvise(mapping, bytes, MADV_HUGEPAGE);
         }
+    #else
+        auto mapping = map_aligned(bytes, align);
+        if (mapping == nullptr)
+            return nullptr;
     #endif
 
-    size_t size()
+    std::lock_guard<std::mutex> guard(heap_mappings_lock);
+    heap_mappings.push_back(HeapMapping { .start = (uintptr_t)mapping, .bytes = bytes });
+    return mapping;
+}
+
+inline void unmap_heap(void* ptr, size_t bytes)
+{
     {
-        return ((size_t*)(bptr - sizeof(size_t)))[0];
+        std::lock_guard<std::mutex> guard(heap_mappings_lock);
+        auto it = std::find_if(heap_mappings.begin(), heap_mappings.end(), [&](auto& m) { return m.start == (uintptr_t)ptr; });
+        if (it != heap_mappings.end())
+        {
+            std::swap(*it, heap_mappings.back());
+            heap_mappings.pop_back();
+        }
     }
 
-    template<typename PointeeT>
-    ref<PointeeT> as_ref()
+    munmap(ptr, bytes);
+}
+
+
+// header-less mode, heap blocks carry no size header: `block::size()` is answered by a radix tree
+// from page to what the allocator put there (a pool span of some size class or a block mapped on its own).
+// `bptr` is the allocator chunk itself, so the size becomes the usable size of the chunk, rounded up to its class,
+// seq keeps the count it was asked for.
+// it always allocates through the pool, arena blocks keep their inline header
+#ifdef EASYSPOT_HEADERLESS
+    using PageEntry = uint64_t;
+
+    /// Low 2 bits of a `PageEntry`
+    enum PageKind : PageEntry
     {
-        return ref<PointeeT>(bptr);
-    }
-};
+        PAGE_UNKNOWN = 0,
+        // the size class index is in the bits above the kind
+        PAGE_POOL = 1,
+        // only the first page of the block has an entry, the alignment log2 is in bits 2..6,
+        // bit 7 is `PAGE_LARGE_FILE` and the size is above them
+        PAGE_LARGE = 2,
+        // blocks inside have an inline size header
+        PAGE_ARENA = 3,
+    };
 
+    /// Set in the entry of blocks backed by a mapped file
+    constexpr PageEntry PAGE_LARGE_FILE = 1 << 7;
 
-/// Typed owning pointer that holds a sequence of concrete elements
-template<typename PointeeT>
-struct seq
+    constexpr int PAGE_MAP_SHIFT = 12;
+    constexpr int PAGE_MAP_LEAF_BITS = 18;
+    constexpr size_t PAGE_MAP_LEAF_SIZE = (size_t)1 << PAGE_MAP_LEAF_BITS;
+    // 48 bits of user address space
+    constexpr size_t PAGE_MAP_ROOT_SIZE = (size_t)1 << (48 - PAGE_MAP_SHIFT - PAGE_MAP_LEAF_BITS);
+
+    /// Two levels radix tree over 4 KiB pages. The root is 2 MiB of zeroed globals and a leaf is a 2 MiB mapping
+    /// made on first use, in both only the pages actually touched cost memory. Leaves are never freed
+    struct PageMap
+    {
+        std::atomic<PageEntry*> leaves[PAGE_MAP_ROOT_SIZE];
+
+        PageEntry get(void* ptr)
+        {
+            auto page = (uintptr_t)ptr >> PAGE_MAP_SHIFT;
+            auto leaf = leaves[page >> PAGE_MAP_LEAF_BITS].load(std::memory_order_acquire);
+            if (leaf == nullptr)
+                return PAGE_UNKNOWN;
+
+            return __atomic_load_n(&leaf[page & (PAGE_MAP_LEAF_SIZE - 1)], __ATOMIC_RELAXED);
+        }
+
+        void set(void* ptr, PageEntry entry)
+        {
+            auto page = (uintptr_t)ptr >> PAGE_MAP_SHIFT;
+            __atomic_store_n(&leaf_of(page)[page & (PAGE_MAP_LEAF_SIZE - 1)], entry, __ATOMIC_RELAXED);
+        }
+
+        /// Every page overlapping [ptr, ptr + bytes)
+        void set_range(void* ptr, size_t bytes, PageEntry entry)
+        {
+            auto first = (uintptr_t)ptr >> PAGE_MAP_SHIFT;
+            auto last = ((uintptr_t)ptr + bytes - 1) >> PAGE_MAP_SHIFT;
+
+            for (auto page = first; page <= last; page++)
+                __atomic_store_n(&leaf_of(page)[page & (PAGE_MAP_LEAF_SIZE - 1)], entry, __ATOMIC_RELAXED);
+        }
+
+        PageEntry* leaf_of(uintptr_t page)
+        {
+            auto& slot = leaves[page >> PAGE_MAP_LEAF_BITS];
+            auto leaf = slot.load(std::memory_order_acquire);
+            if (leaf != nullptr)
+                return leaf;
+
+            auto bytes = PAGE_MAP_LEAF_SIZE * sizeof(PageEntry);
+            auto mapping = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mapping == MAP_FAILED)
+                throw std::bad_alloc();
+
+            // another thread may have installed the leaf meanwhile, then ours goes back
+            if (!slot.compare_exchange_strong(leaf, (PageEntry*)mapping, std::memory_order_acq_rel))
+            {
+                munmap(mapping, bytes);
+                return leaf;
+            }
+
+            return (PageEntry*)mapping;
+        }
+    };
+
+    PageMap page_map;
+#endif
+
+
+/// Size classes of the pool, 8 bytes steps up to 128 bytes then 4 classes per power of two up to 32 KiB.
+/// The fine small steps are what lets a smaller block header actually save memory
+constexpr size_t POOL_SMALL_CLASSES = 16;
+constexpr size_t POOL_CLASS_COUNT = 48;
+constexpr size_t POOL_MAX_SIZE = 32 * 1024;
+constexpr size_t POOL_SPAN_SIZE = 64 * 1024;
+constexpr size_t POOL_REGION_SIZE = 4 * 1024 * 1024;
+
+inline uint32_t pool_class_of(size_t bytes)
 {
-    block b;
+    if (bytes <= 128)
+        return bytes == 0 ? 0 : (uint32_t)((bytes + 7) / 8 - 1);
+
+    auto b = bytes - 1;
+    auto p = 63 - __builtin_clzll(b);
+    return (uint32_t)(POOL_SMALL_CLASSES + (p - 7) * 4 + ((b >> (p - 2)) & 3));
+}
+
+inline size_t pool_class_size(uint32_t class_idx)
+{
+    if (class_idx < POOL_SMALL_CLASSES)
+        return (class_idx + 1) * 8;
+
+    auto p = 7 + (class_idx - POOL_SMALL_CLASSES) / 4;
+    auto k = (class_idx - POOL_SMALL_CLASSES) % 4;
+    return (size_t)(k + 5) << (p - 2);
+}
+
+
+#ifndef EASYSPOT_SCAVENGE_DECAY_MS
+    // spans empty for that long are given back to the os by the scavenger
+    #define EASYSPOT_SCAVENGE_DECAY_MS 1000
+#endif
+
+#ifndef EASYSPOT_SCAVENGE_ADVICE
+    // MADV_FREE is cheaper but the kernel only takes the pages back under memory pressure,
+    // so the resident size doesn't go down until then
+    #define EASYSPOT_SCAVENGE_ADVICE MADV_DONTNEED
+#endif
 
-    seq(size_t capacity) : b(capacity * sizeof(PointeeT))
+/// Cheap clock for idle times, a few ms of resolution are enough
+inline uint64_t coarse_now_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+/// Size class allocator. A 64 KiB span serves one class at a time and has its own free list.
+/// Every thread allocates from spans of its own heap without locking, a chunk dropped by another
+/// thread is pushed on the lock-free remote list of its heap, which the owner takes back in one batch
+/// when a class runs out of room. Spans are carved from 4 MiB regions reserved with mmap, aligned to
+/// their size, the first span of a region holds the metadata of the others. A span left empty goes back
+/// to the pool, where `scavenge` can give its pages back to the os once it's idle for long enough.
+/// Heaps are per thread, so there is only one pool: `global_pool`
+struct Pool
+{
+    struct FreeChunk
     {
+        FreeChunk* next;
+    };
 
-    }
+    struct Heap;
 
-    ~seq()
+    struct Span
     {
-        // not allowed to deallocate internal block
-    }
+        // links in the list of its class while it has room, `next` also links the spans back in the pool
+        Span* prev;
+        Span* next;
+        FreeChunk* free_list;
+        uint8_t* base;
+        uint8_t* bump;
+        // heap allocating from it, it can't change while a chunk of the span is live
+        Heap* owner;
+        uint64_t empty_since_ns;
+        uint32_t class_idx;
+        uint32_t live;
+        bool linked;
+    };
 
-    PointeeT& operator[](size_t idx)
+    static_assert(sizeof(Span) * (POOL_REGION_SIZE / POOL_SPAN_SIZE) <= POOL_SPAN_SIZE, "span metadata must fit in one span");
+
+    /// Only its thread touches the lists, a heap left by an exited thread is taken over by the next new thread
+    struct Heap
     {
-        return *nth(idx).bptr;
-    }
+        Span* with_room[POOL_CLASS_COUNT] = {};
+        std::atomic<FreeChunk*> remote_frees { nullptr };
+        // written by the owner only, chunks still in `remote_frees` count as used
+        std::atomic<size_t> used_bytes { 0 };
+        Heap* next_abandoned = nullptr;
+    };
 
-    size_t capacity()
+    struct HeapOwner
     {
-        return b.size() / sizeof(PointeeT);
-    }
+        Pool* pool = nullptr;
+        Heap* heap = nullptr;
 
-    ref<PointeeT> nth(size_t idx)
+        ~HeapOwner()
+        {
+            if (heap != nullptr)
+                pool->abandon(heap);
+        }
+    };
+
+    std::mutex lock;
+    std::vector<Heap*> heaps;
+    Heap* abandoned = nullptr;
+    // spans no heap owns, the empty ones are still resident, the released ones were scavenged
+    Span* empty = nullptr;
+    Span* released = nullptr;
+    uint8_t* region_cursor = nullptr;
+    uint8_t* region_end = nullptr;
+    size_t mapped_bytes = 0;
+    size_t released_bytes = 0;
+
+    /// `bytes` must not be greater than `POOL_MAX_SIZE`
+    void* alloc(size_t bytes)
     {
-        ASSERTM(idx < capacity(), "Index out of bounds");
-        return ref<PointeeT>(b.bptr + idx * sizeof(PointeeT));
+        return alloc_class(pool_class_of(bytes));
     }
 
-    void drop()
+    /// Chunks of a class are aligned to the biggest power of two dividing its size (up to the span size)
+    void* alloc_class(uint32_t class_idx)
     {
-        b.drop();
-    }
-};
+        auto chunk_size = pool_class_size(class_idx);
+        auto heap = local_heap();
+        auto span = heap->with_room[class_idx];
 
+        if (span == nullptr)
+        {
+            // the chunks other threads dropped may have made room, otherwise a span comes from the pool
+            reclaim_remote_frees(heap);
+            span = heap->with_room[class_idx];
 
-/// Just like `block` has `ref`, so does `seq` with `slice`
-struct slice
+            if (span == nullptr)
+            {
+                span = take_span(heap, class_idx);
+                if (span == nullptr)
+                    return nullptr;
+
+                link(heap, span);
+            }
+        }
+
+        void* chunk;
+        if (span->free_list != nullptr)
+        {
+            chunk = span->free_list;
+            span->free_list = span->free_list->next;
+        }
+        else
+        {
+            chunk = span->bump;
+            span->bump += chunk_size;
+        }
+
+        span->live++;
+        heap->used_bytes.store(heap->used_bytes.load(std::memory_order_relaxed) + chunk_size, std::memory_order_relaxed);
+
+        if (span->free_list == nullptr && span->bump + chunk_size > span->base + POOL_SPAN_SIZE)
+            unlink(heap, span);
+
+        return chunk;
+    }
+
+    /// `bytes` must be the same size passed to `alloc`
+    void free(void* ptr, size_t bytes)
+    {
+        free_class(ptr, pool_class_of(bytes));
+    }
+
+    void free_class(void* ptr, uint32_t class_idx)
+    {
+        auto span = span_of(ptr);
+        auto heap = local_heap();
+        if (span->owner == heap)
+        {
+            free_local(heap, span, (FreeChunk*)ptr);
+            return;
+        }
+
+        // no lock and no write to the span, only the head of the owner's list is contended
+        auto& remote = span->owner->remote_frees;
+        auto chunk = (FreeChunk*)ptr;
+        chunk->next = remote.load(std::memory_order_relaxed);
+        while (!remote.compare_exchange_weak(chunk->next, chunk, std::memory_order_release, std::memory_order_relaxed))
+            ;
+    }
+
+    void free_local(Heap* heap, Span* span, FreeChunk* chunk)
+    {
+        chunk->next = span->free_list;
+        span->free_list = chunk;
+        span->live--;
+        heap->used_bytes.store(heap->used_bytes.load(std::memory_order_relaxed) - pool_class_size(span->class_idx), std::memory_order_relaxed);
+
+        if (!span->linked)
+            link(heap, span);
+
+        // an empty span is kept only while it's the one its class allocates from
+        if (span->live == 0 && (heap->with_room[span->class_idx] != span || span->next != nullptr))
+            give_back(heap, span);
+    }
+
+    void reclaim_remote_frees(Heap* heap)
+    {
+        auto chunk = heap->remote_frees.exchange(nullptr, std::memory_order_acquire);
+        while (chunk != nullptr)
+        {
+            auto next = chunk->next;
+            free_local(heap, span_of(chunk), chunk);
+            chunk = next;
+        }
+    }
+
+    /// Gives back to the os the pages of the spans empty for at least `decay_ns`, returns the bytes released.
+    /// The madvise calls are made without holding the lock, so taking spans isn't stalled meanwhile
+    size_t scavenge(uint64_t decay_ns)
+    {
+        reclaim_abandoned();
+
+        #ifdef EASYSPOT_HUGE_PAGES
+            // a span is a piece of a huge page, madvise fails on explicit ones and splits transparent ones
+            return 0;
+        #endif
+
+        Span* idle = nullptr;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            auto now = coarse_now_ns();
+
+            Span** link = &empty;
+            while (*link != nullptr)
+            {
+                auto span = *link;
+                if (now - span->empty_since_ns >= decay_ns)
+                {
+                    *link = span->next;
+                    span->next = idle;
+                    idle = span;
+                }
+                else
+                    link = &span->next;
+            }
+        }
+
+        if (idle == nullptr)
+            return 0;
+
+        size_t bytes = 0;
+        Span* given_back = nullptr;
+        Span* kept = nullptr;
+        while (idle != nullptr)
+        {
+            auto span = idle;
+            idle = span->next;
+
+            if (madvise(span->base, POOL_SPAN_SIZE, EASYSPOT_SCAVENGE_ADVICE) == 0)
+            {
+                span->next = given_back;
+                given_back = span;
+                bytes += POOL_SPAN_SIZE;
+            }
+            else
+            {
+                // the pages are still there, the span stays empty and is tried again next pass
+                span->next = kept;
+                kept = span;
+            }
+        }
+
+        std::lock_guard<std::mutex> guard(lock);
+        while (given_back != nullptr)
+        {
+            auto span = given_back;
+            given_back = span->next;
+            span->next = released;
+            released = span;
+        }
+
+        while (kept != nullptr)
+        {
+            auto span = kept;
+            kept = span->next;
+            span->next = empty;
+            empty = span;
+        }
+
+        released_bytes += bytes;
+        return bytes;
+    }
+
+    /// Nobody else reclaims the remote frees of the heaps of exited threads, they are owned meanwhile
+    void reclaim_abandoned()
+    {
+        Heap* heaps_left;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            heaps_left = abandoned;
+            abandoned = nullptr;
+        }
+
+        if (heaps_left == nullptr)
+            return;
+
+        auto last = heaps_left;
+        for (auto heap = heaps_left; heap != nullptr; heap = heap->next_abandoned)
+        {
+            reclaim_remote_frees(heap);
+            last = heap;
+        }
+
+        std::lock_guard<std::mutex> guard(lock);
+        last->next_abandoned = abandoned;
+        abandoned = heaps_left;
+    }
+
+    /// Sum of the heaps, chunks dropped by another thread count until their owner reclaims them
+    size_t used_bytes()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        size_t used = 0;
+        for (auto heap : heaps)
+            used += heap->used_bytes.load(std::memory_order_relaxed);
+
+        return used;
+    }
+
+    Span* span_of(void* ptr)
+    {
+        auto region = (uintptr_t)ptr & ~(uintptr_t)(POOL_REGION_SIZE - 1);
+        return (Span*)region + ((uintptr_t)ptr - region) / POOL_SPAN_SIZE;
+    }
+
+    Heap* local_heap()
+    {
+        static thread_local HeapOwner owner;
+        if (owner.heap != nullptr)
+            return owner.heap;
+
+        std::lock_guard<std::mutex> guard(lock);
+        if (abandoned != nullptr)
+        {
+            owner.heap = abandoned;
+            abandoned = abandoned->next_abandoned;
+        }
+        else
+        {
+            owner.heap = new Heap();
+            heaps.push_back(owner.heap);
+        }
+
+        owner.pool = this;
+        return owner.heap;
+    }
+
+    /// Its spans stay owned, other threads keep pushing on its remote list until a new thread
+    /// or a scavenge pass takes it
+    void abandon(Heap* heap)
+    {
+        reclaim_remote_frees(heap);
+        std::lock_guard<std::mutex> guard(lock);
+        heap->next_abandoned = abandoned;
+        abandoned = heap;
+    }
+
+    void link(Heap* heap, Span* span)
+    {
+        auto& head = heap->with_room[span->class_idx];
+        span->prev = nullptr;
+        span->next = head;
+        if (head != nullptr)
+            head->prev = span;
+
+        head = span;
+        span->linked = true;
+
+        // the previous span of the class may have been kept only because it was the first
+        if (span->next != nullptr && span->next->live == 0)
+            give_back(heap, span->next);
+    }
+
+    void unlink(Heap* heap, Span* span)
+    {
+        if (span->prev != nullptr)
+            span->prev->next = span->next;
+        else
+            heap->with_room[span->class_idx] = span->next;
+
+        if (span->next != nullptr)
+            span->next->prev = span->prev;
+
+        span->linked = false;
+    }
+
+    void give_back(Heap* heap, Span* span)
+    {
+        unlink(heap, span);
+        span->owner = nullptr;
+        span->empty_since_ns = coarse_now_ns();
+
+        std::lock_guard<std::mutex> guard(lock);
+        span->next = empty;
+        empty = span;
+    }
+
+    /// The last empty span given back if any, then a released one whose pages come back zeroed on first touch,
+    /// otherwise a new one
+    Span* take_span(Heap* heap, uint32_t class_idx)
+    {
+        Span* span;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (empty != nullptr)
+            {
+                span = empty;
+                empty = span->next;
+            }
+            else if (released != nullptr)
+            {
+                span = released;
+                released = span->next;
+                released_bytes -= POOL_SPAN_SIZE;
+            }
+            else
+            {
+                if (region_cursor == region_end)
+                {
+                    // regions are aligned to their size, so the metadata of a chunk is found by masking its address
+                    auto region = (uint8_t*)map_heap(POOL_REGION_SIZE, POOL_REGION_SIZE);
+                    if (region == nullptr)
+                        return nullptr;
+
+                    region_cursor = region + POOL_SPAN_SIZE;
+                    region_end = region + POOL_REGION_SIZE;
+                    mapped_bytes += POOL_REGION_SIZE;
+                }
+
+                span = span_of(region_cursor);
+                span->base = region_cursor;
+                region_cursor += POOL_SPAN_SIZE;
+            }
+        }
+
+        span->free_list = nullptr;
+        span->bump = span->base;
+        span->owner = heap;
+        span->class_idx = class_idx;
+        span->live = 0;
+        span->linked = false;
+
+        #ifdef EASYSPOT_HEADERLESS
+            page_map.set_range(span->base, POOL_SPAN_SIZE, PAGE_POOL | (PageEntry)class_idx << 2);
+        #endif
+
+        return span;
+    }
+};
+
+Pool global_pool;
+
+
+/// Background thread calling `global_pool.scavenge` every half decay, stopped at exit
+struct Scavenger
+{
+    std::thread thread;
+    std::mutex lock;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    ~Scavenger()
+    {
+        stop();
+    }
+
+    void start(uint64_t decay_ms)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (thread.joinable())
+            return;
+
+        stopping = false;
+        thread = std::thread([this, decay_ms]
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            while (!wake.wait_for(guard, std::chrono::milliseconds(std::max<uint64_t>(decay_ms / 2, 1)), [&] { return stopping; }))
+            {
+                guard.unlock();
+                global_pool.scavenge(decay_ms * 1000000);
+                guard.lock();
+            }
+        });
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+
+        wake.notify_all();
+        if (thread.joinable())
+            thread.join();
+    }
+};
+
+Scavenger scavenger;
+
+namespace es
+{
+    /// Pool spans empty for `decay_ms` are given back to the os from a background thread,
+    /// allocations and drops never wait on it
+    void start_scavenger(uint64_t decay_ms = EASYSPOT_SCAVENGE_DECAY_MS)
+    {
+        scavenger.start(decay_ms);
+    }
+
+    void stop_scavenger()
+    {
+        scavenger.stop();
+    }
+
+    /// Same as one pass of the scavenger, returns the bytes given back
+    size_t scavenge(uint64_t decay_ms = EASYSPOT_SCAVENGE_DECAY_MS)
+    {
+        return global_pool.scavenge(decay_ms * 1000000);
+    }
+}
+
+
+/// Bump allocator, chunks taken from it are never freed one by one,
+/// `reset()` releases all of them at once. It is not thread safe
+struct arena
+{
+    struct Chunk
+    {
+        Chunk* next;
+        size_t size;
+    };
+
+    Chunk* chunks = nullptr;
+    uint8_t* cursor = nullptr;
+    uint8_t* end = nullptr;
+    size_t chunk_size;
+    size_t mapped_bytes = 0;
+    size_t used_bytes = 0;
+
+    arena(size_t chunk_size = 1024 * 1024) : chunk_size(chunk_size)
+    {
+
+    }
+
+    ~arena()
+    {
+        reset();
+    }
+
+    void* alloc(size_t bytes, size_t align = 16)
+    {
+        auto aligned = (uint8_t*)(((uintptr_t)cursor + align - 1) & ~(uintptr_t)(align - 1));
+        if (cursor == nullptr || aligned + bytes > end)
+        {
+            // oversized requests get a chunk of their own
+            auto size = heap_round(std::max(chunk_size, sizeof(Chunk) + bytes + align));
+            auto mapping = map_heap(size, page_size());
+            if (mapping == nullptr)
+                return nullptr;
+
+            auto chunk = (Chunk*)mapping;
+            chunk->next = chunks;
+            chunk->size = size;
+            chunks = chunk;
+            mapped_bytes += size;
+
+            #ifdef EASYSPOT_HEADERLESS
+                page_map.set_range(chunk, size, PAGE_ARENA);
+            #endif
+
+            cursor = (uint8_t*)(chunk + 1);
+            end = (uint8_t*)chunk + size;
+            aligned = (uint8_t*)(((uintptr_t)cursor + align - 1) & ~(uintptr_t)(align - 1));
+        }
+
+        cursor = aligned + bytes;
+        used_bytes += bytes;
+        return aligned;
+    }
+
+    void reset()
+    {
+        while (chunks != nullptr)
+        {
+            auto next = chunks->next;
+
+            #ifdef EASYSPOT_HEADERLESS
+                page_map.set_range(chunks, chunks->size, PAGE_UNKNOWN);
+            #endif
+
+            unmap_heap(chunks, chunks->size);
+            chunks = next;
+        }
+
+        cursor = nullptr;
+        end = nullptr;
+        mapped_bytes = 0;
+        used_bytes = 0;
+    }
+};
+
+
+namespace es
+{
+    struct page_stats
+    {
+        // pool regions and arena chunks
+        size_t mapped_bytes = 0;
+        size_t resident_bytes = 0;
+        // transparent (AnonHugePages) and explicit (Hugetlb) huge pages
+        size_t huge_bytes = 0;
+        // pool chunks handed out, what the resident size would be without fragmentation
+        size_t in_use_bytes = 0;
+        // pool spans the scavenger gave back
+        size_t released_bytes = 0;
+    };
+
+    /// How the kernel backs the heap, read from /proc/self/smaps. A heap mapping the kernel merged
+    /// with a neighbouring one is counted in proportion of the part that is heap
+    page_stats heap_page_stats()
+    {
+        page_stats stats;
+        std::vector<HeapMapping> mappings;
+        {
+            std::lock_guard<std::mutex> guard(heap_mappings_lock);
+            mappings = heap_mappings;
+        }
+
+        for (auto& m : mappings)
+            stats.mapped_bytes += m.bytes;
+
+        {
+            stats.in_use_bytes = global_pool.used_bytes();
+            std::lock_guard<std::mutex> guard(global_pool.lock);
+            stats.released_bytes = global_pool.released_bytes;
+        }
+
+        auto f = fopen("/proc/self/smaps", "r");
+        if (f == nullptr)
+            return stats;
+
+        char line[4096];
+        double heap_fraction = 0;
+        while (fgets(line, sizeof(line), f) != nullptr)
+        {
+            unsigned long lo, hi;
+            if (sscanf(line, "%lx-%lx", &lo, &hi) == 2)
+            {
+                size_t overlap = 0;
+                for (auto& m : mappings)
+                {
+                    auto start = std::max<uintptr_t>(lo, m.start);
+                    auto end = std::min<uintptr_t>(hi, m.start + m.bytes);
+                    if (start < end)
+                        overlap += end - start;
+                }
+
+                heap_fraction = hi > lo ? (double)overlap / (hi - lo) : 0;
+                continue;
+            }
+
+            char field[64];
+            size_t kb;
+            if (heap_fraction == 0 || sscanf(line, "%63[^:]: %zu kB", field, &kb) != 2)
+                continue;
+
+            auto bytes = (size_t)(kb * 1024 * heap_fraction);
+            if (strcmp(field, "Rss") == 0)
+                stats.resident_bytes += bytes;
+            else if (strcmp(field, "AnonHugePages") == 0)
+                stats.huge_bytes += bytes;
+            else if (strcmp(field, "Private_Hugetlb") == 0 || strcmp(field, "Shared_Hugetlb") == 0)
+            {
+                // explicit huge pages are not in Rss
+                stats.resident_bytes += bytes;
+                stats.huge_bytes += bytes;
+            }
+        }
+
+        fclose(f);
+        return stats;
+    }
+
+    /// Resident size of the whole process, from /proc/self/statm, 0 if it can't be read.
+    /// Cheaper than `heap_page_stats()`, for measuring around a workload
+    size_t process_rss_bytes()
+    {
+        long pages_total = 0;
+        long pages_resident = 0;
+        auto f = fopen("/proc/self/statm", "r");
+        if (f == nullptr)
+            return 0;
+
+        if (fscanf(f, "%ld %ld", &pages_total, &pages_resident) != 2)
+            pages_resident = 0;
+
+        fclose(f);
+        return (size_t)pages_resident * page_size();
+    }
+}
+
+constexpr size_t CACHE_LINE = 64;
+
+
+// allocation statistics, always on, release builds included. each thread counts in its own slots with
+// plain relaxed stores, nothing is shared on the alloc/drop path, `es::heap_alloc_stats()` sums the slots
+// of every thread on read. blocks over `POOL_MAX_SIZE` share the last size class
+constexpr size_t STATS_CLASS_COUNT = POOL_CLASS_COUNT + 1;
+
+// a thread publishes its net bytes to the peak tracking in steps of that much
+constexpr int64_t STATS_PEAK_STEP = 64 * 1024;
+
+/// Counters of one thread, the totals are sums over the classes. A block dropped by another thread
+/// than its allocating one makes the live counters of both wrap, only the sum over all threads means something
+struct alignas(CACHE_LINE) ThreadStats
+{
+    // the counters of a class share a cache line, a block touches only one
+    struct alignas(32) ClassCounters
+    {
+        std::atomic<uint64_t> allocs { 0 };
+        std::atomic<uint64_t> live { 0 };
+        std::atomic<uint64_t> live_bytes { 0 };
+    };
+
+    ClassCounters classes[STATS_CLASS_COUNT];
+    // bytes allocated minus dropped not yet added to `stats_published_bytes`, only its thread touches it
+    int64_t unpublished_bytes = 0;
+    ThreadStats* next = nullptr;
+    ThreadStats* next_abandoned = nullptr;
+};
+
+std::mutex thread_stats_lock;
+ThreadStats* all_thread_stats = nullptr;
+// counters of exited threads, the next new thread counts on in one of them
+ThreadStats* abandoned_thread_stats = nullptr;
+std::atomic<int64_t> stats_published_bytes { 0 };
+std::atomic<int64_t> stats_peak_bytes { 0 };
+
+static thread_local ThreadStats* thread_stats = nullptr;
+
+/// Only the owner writes its counters, a load and a store are enough and cheaper than an atomic add
+inline void stats_bump(std::atomic<uint64_t>& counter, uint64_t amount)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+inline uint32_t stats_class_of(size_t bytes)
+{
+    return bytes <= POOL_MAX_SIZE ? pool_class_of(bytes) : POOL_CLASS_COUNT;
+}
+
+/// The peak is exact up to `STATS_PEAK_STEP` per thread, publishing on every block would share a cache line
+__attribute__((noinline)) inline void stats_publish(ThreadStats* stats)
+{
+    auto live = stats_published_bytes.fetch_add(stats->unpublished_bytes, std::memory_order_relaxed) + stats->unpublished_bytes;
+    stats->unpublished_bytes = 0;
+
+    auto peak = stats_peak_bytes.load(std::memory_order_relaxed);
+    while (live > peak && !stats_peak_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+    {
+
+    }
+}
+
+struct ThreadStatsOwner
+{
+    ThreadStats* stats = nullptr;
+
+    ~ThreadStatsOwner()
+    {
+        if (stats == nullptr)
+            return;
+
+        stats_publish(stats);
+        thread_stats = nullptr;
+
+        std::lock_guard<std::mutex> guard(thread_stats_lock);
+        stats->next_abandoned = abandoned_thread_stats;
+        abandoned_thread_stats = stats;
+    }
+};
+
+__attribute__((noinline)) inline ThreadStats* register_thread_stats()
+{
+    static thread_local ThreadStatsOwner owner;
+
+    std::lock_guard<std::mutex> guard(thread_stats_lock);
+    if (abandoned_thread_stats != nullptr)
+    {
+        owner.stats = abandoned_thread_stats;
+        abandoned_thread_stats = abandoned_thread_stats->next_abandoned;
+    }
+    else
+    {
+        // never freed, the counts of exited threads stay in the sums
+        owner.stats = new ThreadStats();
+        owner.stats->next = all_thread_stats;
+        all_thread_stats = owner.stats;
+    }
+
+    thread_stats = owner.stats;
+    return owner.stats;
+}
+
+/// Moves `bytes` in or out of the live counters, `count` is 1, -1 or 0 when a resize keeps the block
+inline void stats_move(size_t bytes, int64_t count, bool in)
+{
+    auto stats = thread_stats != nullptr ? thread_stats : register_thread_stats();
+    auto& counters = stats->classes[stats_class_of(bytes)];
+    auto signed_bytes = in ? (int64_t)bytes : -(int64_t)bytes;
+
+    stats_bump(counters.live, in ? 1 : -1);
+    stats_bump(counters.live_bytes, signed_bytes);
+    if (count > 0)
+        stats_bump(counters.allocs, 1);
+
+    stats->unpublished_bytes += signed_bytes;
+    if (stats->unpublished_bytes >= STATS_PEAK_STEP || stats->unpublished_bytes <= -STATS_PEAK_STEP)
+        stats_publish(stats);
+}
+
+inline void stats_alloc(size_t bytes)
+{
+    stats_move(bytes, 1, true);
+}
+
+inline void stats_drop(size_t bytes)
+{
+    stats_move(bytes, -1, false);
+}
+
+inline void stats_resize(size_t old_bytes, size_t new_bytes)
+{
+    stats_move(old_bytes, 0, false);
+    stats_move(new_bytes, 0, true);
+}
+
+namespace es
+{
+    struct size_class_stats
+    {
+        // largest block size of the class, `SIZE_MAX` for the blocks over `POOL_MAX_SIZE`
+        size_t max_size = 0;
+        uint64_t allocs = 0;
+        uint64_t live_count = 0;
+        uint64_t live_bytes = 0;
+    };
+
+    struct alloc_stats
+    {
+        uint64_t live_bytes = 0;
+        uint64_t live_count = 0;
+        // exact up to 64 KiB per thread, see `STATS_PEAK_STEP`
+        uint64_t peak_bytes = 0;
+        uint64_t allocs = 0;
+        uint64_t drops = 0;
+        // only the classes that ever had a block, smallest first
+        std::vector<size_class_stats> classes;
+    };
+
+    /// Sums the counters of every thread. Counting goes on meanwhile, in a busy process the totals
+    /// can miss the blocks allocated or dropped during the read
+    alloc_stats heap_alloc_stats()
+    {
+        alloc_stats stats;
+        size_class_stats classes[STATS_CLASS_COUNT];
+
+        {
+            std::lock_guard<std::mutex> guard(thread_stats_lock);
+            for (auto t = all_thread_stats; t != nullptr; t = t->next)
+                for (size_t i = 0; i < STATS_CLASS_COUNT; i++)
+                {
+                    classes[i].allocs += t->classes[i].allocs.load(std::memory_order_relaxed);
+                    classes[i].live_count += t->classes[i].live.load(std::memory_order_relaxed);
+                    classes[i].live_bytes += t->classes[i].live_bytes.load(std::memory_order_relaxed);
+                }
+        }
+
+        for (size_t i = 0; i < STATS_CLASS_COUNT; i++)
+        {
+            classes[i].max_size = i < POOL_CLASS_COUNT ? pool_class_size(i) : SIZE_MAX;
+            stats.allocs += classes[i].allocs;
+            stats.live_count += classes[i].live_count;
+            stats.live_bytes += classes[i].live_bytes;
+            if (classes[i].allocs != 0 || classes[i].live_count != 0)
+                stats.classes.push_back(classes[i]);
+        }
+
+        // a resize moves a block to another class, the live count over all classes is still right
+        stats.drops = stats.allocs - stats.live_count;
+        stats.peak_bytes = std::max<uint64_t>(stats_peak_bytes.load(std::memory_order_relaxed), stats.live_bytes);
+        return stats;
+    }
+}
+
+#ifdef EASYSPOT_COMPACT_HEADER
+    /// 4 bytes header for heaps of tiny blocks, sizes that don't fit are kept out of line.
+    /// `bptr` is only 4 bytes aligned, seq and vec of wider types take the aligned path
+    using BlockHeader = uint32_t;
+#else
+    using BlockHeader = size_t;
+#endif
+
+constexpr int BLOCK_HEADER_BITS = sizeof(BlockHeader) * 8;
+
+/// Set in the size header of blocks taken from an `arena`, their memory is released by the arena itself
+constexpr BlockHeader BLOCK_ARENA_FLAG = (BlockHeader)1 << (BLOCK_HEADER_BITS - 1);
+
+/// Set in the size header of blocks allocated with an alignment over the header one
+constexpr BlockHeader BLOCK_ALIGNED_FLAG = (BlockHeader)1 << (BLOCK_HEADER_BITS - 2);
+
+constexpr BlockHeader BLOCK_FLAGS = BLOCK_ARENA_FLAG | BLOCK_ALIGNED_FLAG;
+
+/// Both flags at once, which no other block has, mark a block backed by a mapped file
+constexpr BlockHeader BLOCK_FILE_FLAGS = BLOCK_FLAGS;
+
+/// Size field value of blocks whose size is kept in `out_of_line_sizes`
+constexpr BlockHeader BLOCK_SIZE_OUT_OF_LINE = ~BLOCK_FLAGS;
+
+/// Alignment of every allocation `block_alloc` returns (pool chunks are the weakest)
+constexpr size_t BLOCK_MIN_ALIGN = 8;
+
+#ifdef EASYSPOT_COMPACT_HEADER
+    std::unordered_map<OwningPointer, size_t> out_of_line_sizes;
+    std::mutex out_of_line_sizes_lock;
+#endif
+
+inline BlockHeader& block_header_of(OwningPointer bptr)
+{
+    return ((BlockHeader*)(bptr - sizeof(BlockHeader)))[0];
+}
+
+/// Reads the size header in front of an owning pointer
+inline size_t header_size_of(OwningPointer bptr)
+{
+    auto size = block_header_of(bptr) & ~BLOCK_FLAGS;
+
+    #ifdef EASYSPOT_COMPACT_HEADER
+        if (size == BLOCK_SIZE_OUT_OF_LINE)
+        {
+            std::lock_guard<std::mutex> guard(out_of_line_sizes_lock);
+            return out_of_line_sizes[bptr];
+        }
+    #endif
+
+    return size;
+}
+
+inline void write_block_header(OwningPointer bptr, size_t size, BlockHeader flags)
+{
+    #ifdef EASYSPOT_COMPACT_HEADER
+        if (size >= BLOCK_SIZE_OUT_OF_LINE)
+        {
+            std::lock_guard<std::mutex> guard(out_of_line_sizes_lock);
+            out_of_line_sizes[bptr] = size;
+            size = BLOCK_SIZE_OUT_OF_LINE;
+        }
+    #endif
+
+    block_header_of(bptr) = (BlockHeader)size | flags;
+}
+
+/// Must be called before the memory of the block is released
+inline void forget_block_header(OwningPointer bptr)
+{
+    #ifdef EASYSPOT_COMPACT_HEADER
+        if ((block_header_of(bptr) & ~BLOCK_FLAGS) == BLOCK_SIZE_OUT_OF_LINE)
+        {
+            std::lock_guard<std::mutex> guard(out_of_line_sizes_lock);
+            out_of_line_sizes.erase(bptr);
+        }
+    #endif
+}
+
+/// Aligned blocks are over-allocated and `bptr` is pushed forward to the alignment,
+/// the word before the size header remembers how far and the alignment asked
+struct AlignedPrefix
+{
+    uint32_t offset : 24;
+    uint32_t align_log2 : 8;
+};
+
+constexpr size_t BLOCK_MAX_ALIGN = (size_t)1 << 22;
+
+inline AlignedPrefix& aligned_prefix_of(OwningPointer bptr)
+{
+    return *(AlignedPrefix*)((uintptr_t)bptr - sizeof(BlockHeader) - sizeof(AlignedPrefix));
+}
+
+// prefix and header in front of an aligned `bptr`. `bptr` is a multiple of `BLOCK_MIN_ALIGN` past the
+// allocation, so the room taken is the next multiple of it (12 bytes of prefix and header take 16)
+constexpr size_t ALIGNED_ROOM = (sizeof(AlignedPrefix) + sizeof(BlockHeader) + BLOCK_MIN_ALIGN - 1) & ~(BLOCK_MIN_ALIGN - 1);
+
+inline size_t aligned_alloc_bytes(size_t size, size_t align)
+{
+    // the allocation is already `BLOCK_MIN_ALIGN` aligned, only the rest must be paid as slack
+    auto slack = align > BLOCK_MIN_ALIGN ? align - BLOCK_MIN_ALIGN : 0;
+    return ALIGNED_ROOM + slack + size;
+}
+
+/// First aligned address of `raw` with room for the prefix and the header in front, the prefix is written
+inline OwningPointer place_aligned(OwningPointer raw, size_t size, size_t align)
+{
+    auto room = sizeof(AlignedPrefix) + sizeof(BlockHeader);
+    auto ptr = (OwningPointer)(((uintptr_t)raw + room + align - 1) & ~(uintptr_t)(align - 1));
+    ASSERTM(ptr + size <= raw + aligned_alloc_bytes(size, align), "Aligned block placed past its allocation");
+    aligned_prefix_of(ptr) = AlignedPrefix { .offset = (uint32_t)(ptr - raw), .align_log2 = (uint32_t)__builtin_ctzll(align) };
+    return ptr;
+}
+
+/// Start of the allocation of a non arena block
+inline OwningPointer block_raw_of(OwningPointer bptr)
+{
+    if (block_header_of(bptr) & BLOCK_ALIGNED_FLAG)
+        return bptr - aligned_prefix_of(bptr).offset;
+
+    return bptr - sizeof(BlockHeader);
+}
+
+/// Bytes that were asked to `block_alloc` for a non arena block
+inline size_t block_alloc_bytes(OwningPointer bptr)
+{
+    if (block_header_of(bptr) & BLOCK_ALIGNED_FLAG)
+        return aligned_alloc_bytes(header_size_of(bptr), (size_t)1 << aligned_prefix_of(bptr).align_log2);
+
+    return sizeof(BlockHeader) + header_size_of(bptr);
+}
+
+#ifndef EASYSPOT_LARGE_BLOCK
+    // blocks from this size up are mapped on their own, so they can be grown in place with mremap,
+    // their untouched pages cost nothing and they start zeroed. MAP_NORESERVE leaves them out of the
+    // commit charge, so a sparse multi GB seq doesn't fail under strict overcommit until it's touched
+    #define EASYSPOT_LARGE_BLOCK (1024 * 1024)
+#endif
+
+constexpr int LARGE_BLOCK_MAP_FLAGS = MAP_NORESERVE;
+
+/// Backend of non arena blocks, `EASYSPOT_POOL` routes the small ones to the pool
+/// and the large ones always get a mapping of their own
+inline OwningPointer block_alloc(size_t bytes)
+{
+    if (bytes >= EASYSPOT_LARGE_BLOCK)
+    {
+        auto mapping = mmap(nullptr, page_round(bytes), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | LARGE_BLOCK_MAP_FLAGS, -1, 0);
+        if (mapping == MAP_FAILED)
+            throw std::bad_alloc();
+
+        return (OwningPointer)mapping;
+    }
+
+    #ifdef EASYSPOT_POOL
+        if (bytes <= POOL_MAX_SIZE)
+        {
+            auto ptr = global_pool.alloc(bytes);
+            if (ptr == nullptr)
+                throw std::bad_alloc();
+
+            return (OwningPointer)ptr;
+        }
+    #endif
+
+    return new uint8_t[bytes];
+}
+
+inline void block_free(OwningPointer ptr, size_t bytes)
+{
+    if (bytes >= EASYSPOT_LARGE_BLOCK)
+    {
+        munmap(ptr, page_round(bytes));
+        return;
+    }
+
+    #ifdef EASYSPOT_POOL
+        if (bytes <= POOL_MAX_SIZE)
+        {
+            global_pool.free(ptr, bytes);
+            return;
+        }
+    #endif
+
+    delete[] ptr;
+}
+
+/// Keeps the first `min(old_bytes, new_bytes)` bytes. Large blocks are remapped by the kernel,
+/// in place when the virtual range can be extended and by moving page tables otherwise,
+/// never by copying. Pool chunks stay in place while the size class doesn't change
+inline OwningPointer block_realloc(OwningPointer ptr, size_t old_bytes, size_t new_bytes)
+{
+    if (old_bytes >= EASYSPOT_LARGE_BLOCK && new_bytes >= EASYSPOT_LARGE_BLOCK)
+    {
+        auto mapping = mremap(ptr, page_round(old_bytes), page_round(new_bytes), MREMAP_MAYMOVE);
+        if (mapping == MAP_FAILED)
+            throw std::bad_alloc();
+
+        return (OwningPointer)mapping;
+    }
+
+    #ifdef EASYSPOT_POOL
+        if (old_bytes <= POOL_MAX_SIZE && new_bytes <= POOL_MAX_SIZE && pool_class_of(old_bytes) == pool_class_of(new_bytes))
+            return ptr;
+    #endif
+
+    auto fresh = block_alloc(new_bytes);
+    memcpy(fresh, ptr, std::min(old_bytes, new_bytes));
+    block_free(ptr, old_bytes);
+    return fresh;
+}
+
+
+/// The memory belongs to `a` and is released by `a.reset()`, arena blocks always have the size header
+inline OwningPointer block_create_in(arena& a, size_t size)
+{
+    auto bptr = (OwningPointer)a.alloc(sizeof(BlockHeader) + size) + sizeof(BlockHeader);
+    write_block_header(bptr, size, BLOCK_ARENA_FLAG);
+    return bptr;
+}
+
+inline void seal_saved_file(OwningPointer bptr, size_t size);
+
+#ifdef EASYSPOT_HEADERLESS
+    /// Smallest class at least `bytes` big whose chunks are aligned to `align`, `POOL_CLASS_COUNT` if none
+    inline uint32_t pool_class_aligned(size_t bytes, size_t align)
+    {
+        auto class_idx = pool_class_of(std::max(bytes, align));
+        while (class_idx < POOL_CLASS_COUNT && pool_class_size(class_idx) % align != 0)
+            class_idx++;
+
+        return class_idx;
+    }
+
+    inline PageEntry large_page_entry(size_t size, size_t align, PageEntry flags = 0)
+    {
+        return PAGE_LARGE | (PageEntry)__builtin_ctzll(align) << 2 | flags | (PageEntry)size << 8;
+    }
+
+    /// Mapping of its own for a block
+    inline OwningPointer map_block(size_t size, size_t align)
+    {
+        auto bptr = (OwningPointer)map_aligned(page_round(std::max<size_t>(size, 1)), align, LARGE_BLOCK_MAP_FLAGS);
+        if (bptr == nullptr)
+            throw std::bad_alloc();
+
+        page_map.set(bptr, large_page_entry(size, align));
+        return bptr;
+    }
+
+    inline size_t block_size_of(OwningPointer bptr)
+    {
+        auto entry = page_map.get(bptr);
+        switch (entry & 3)
+        {
+            case PAGE_POOL:
+                return pool_class_size((uint32_t)(entry >> 2));
+            case PAGE_LARGE:
+                return entry >> 8;
+            case PAGE_ARENA:
+                return header_size_of(bptr);
+        }
+
+        PANIC("Block unknown to the allocator");
+        return 0;
+    }
+
+    /// `bptr` is a pool chunk, or a mapping of its own when no class fits `size` and `align` (a power of two)
+    inline OwningPointer block_create(size_t size, size_t align)
+    {
+        ASSERTM((align & (align - 1)) == 0 && align <= BLOCK_MAX_ALIGN, "Alignment must be a power of two up to 4 MiB");
+
+        if (size <= POOL_MAX_SIZE)
+        {
+            auto class_idx = pool_class_aligned(size, align);
+            if (class_idx < POOL_CLASS_COUNT)
+            {
+                auto ptr = global_pool.alloc_class(class_idx);
+                if (ptr == nullptr)
+                    throw std::bad_alloc();
+
+                return (OwningPointer)ptr;
+            }
+        }
+
+        return map_block(size, align);
+    }
+
+    /// `size` bytes of `fd` from `offset` (page aligned) mapped with `prot`, the entry is the one of a large block.
+    /// Returns `nullptr` on failure
+    inline OwningPointer block_map_file(int fd, size_t offset, size_t size, int prot)
+    {
+        // an empty file can't be mapped, an anonymous page stands for it
+        auto mapping = size > 0
+            ? mmap(nullptr, size, prot, MAP_SHARED, fd, offset)
+            : mmap(nullptr, page_size(), PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (mapping == MAP_FAILED)
+            return nullptr;
+
+        page_map.set(mapping, large_page_entry(size, page_size(), PAGE_LARGE_FILE));
+        return (OwningPointer)mapping;
+    }
+
+    /// Blocks mapped on their own are fresh zero pages, only pool chunks are cleared
+    inline OwningPointer block_create_zeroed(size_t size, size_t align)
+    {
+        auto bptr = block_create(size, align);
+        if ((page_map.get(bptr) & 3) != PAGE_LARGE)
+            memset(bptr, 0, size);
+
+        return bptr;
+    }
+
+    inline void block_destroy(OwningPointer bptr)
+    {
+        auto entry = page_map.get(bptr);
+        switch (entry & 3)
+        {
+            case PAGE_POOL:
+                global_pool.free_class(bptr, (uint32_t)(entry >> 2));
+                return;
+            case PAGE_LARGE:
+                if (entry & PAGE_LARGE_FILE)
+                    seal_saved_file(bptr, entry >> 8);
+
+                page_map.set(bptr, PAGE_UNKNOWN);
+                munmap(bptr, page_round(std::max<size_t>(entry >> 8, 1)));
+                return;
+            case PAGE_ARENA:
+                forget_block_header(bptr);
+                return;
+        }
+
+        PANIC("Drop of a block unknown to the allocator");
+    }
+
+    /// The alignment asked at creation isn't stored for pool chunks, the one the chunk has is kept,
+    /// which may be more than what was asked
+    inline OwningPointer block_recreate(OwningPointer bptr, size_t new_size)
+    {
+        auto entry = page_map.get(bptr);
+        auto old_size = block_size_of(bptr);
+        size_t align = 1;
+
+        if ((entry & 3) == PAGE_POOL)
+        {
+            auto class_idx = (uint32_t)(entry >> 2);
+            auto chunk_align = (size_t)1 << std::min(__builtin_ctzll((uintptr_t)bptr), __builtin_ctzll(pool_class_size(class_idx)));
+            align = std::min(chunk_align, POOL_SPAN_SIZE);
+
+            if (new_size <= POOL_MAX_SIZE && pool_class_aligned(new_size, align) == class_idx)
+                return bptr;
+        }
+        else if ((entry & 3) == PAGE_LARGE)
+        {
+            align = (size_t)1 << ((entry >> 2) & 31);
+
+            // remapping only keeps the page alignment, and would grow a file mapping past the end of the file
+            if (new_size > POOL_MAX_SIZE && align <= page_size() && !(entry & PAGE_LARGE_FILE))
+            {
+                auto mapping = mremap(bptr, page_round(std::max<size_t>(old_size, 1)), page_round(new_size), MREMAP_MAYMOVE);
+                if (mapping == MAP_FAILED)
+                    throw std::bad_alloc();
+
+                page_map.set(bptr, PAGE_UNKNOWN);
+                page_map.set(mapping, large_page_entry(new_size, align));
+                return (OwningPointer)mapping;
+            }
+        }
+
+        // arena and file blocks move to the heap, the arena keeps the old memory until its reset
+        auto fresh = block_create(new_size, align);
+        memcpy(fresh, bptr, std::min(old_size, new_size));
+        block_destroy(bptr);
+        return fresh;
+    }
+#else
+    inline size_t block_size_of(OwningPointer bptr)
+    {
+        return header_size_of(bptr);
+    }
+
+    /// `bptr` is aligned to `align` (a power of two), the size header stays right in front of it
+    inline OwningPointer block_create(size_t size, size_t align)
+    {
+        if (align <= alignof(BlockHeader))
+        {
+            auto bptr = block_alloc(sizeof(BlockHeader) + size) + sizeof(BlockHeader);
+            write_block_header(bptr, size, 0);
+            return bptr;
+        }
+
+        ASSERTM((align & (align - 1)) == 0 && align <= BLOCK_MAX_ALIGN, "Alignment must be a power of two up to 4 MiB");
+        auto bptr = place_aligned(block_alloc(aligned_alloc_bytes(size, align)), size, align);
+        write_block_header(bptr, size, BLOCK_ALIGNED_FLAG);
+        return bptr;
+    }
+
+    /// `size` bytes of `fd` from `offset` (page aligned) mapped with `prot` right after a private page,
+    /// whose end holds the size header. Returns `nullptr` on failure
+    inline OwningPointer block_map_file(int fd, size_t offset, size_t size, int prot)
+    {
+        auto reserved = page_size() + page_round(size);
+        auto mapping = (OwningPointer)mmap(nullptr, reserved, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (mapping == MAP_FAILED)
+            return nullptr;
+
+        auto bptr = mapping + page_size();
+        if (size > 0 && mmap(bptr, size, prot, MAP_SHARED | MAP_FIXED, fd, offset) == MAP_FAILED)
+        {
+            munmap(mapping, reserved);
+            return nullptr;
+        }
+
+        write_block_header(bptr, size, BLOCK_FILE_FLAGS);
+        return bptr;
+    }
+
+    /// Blocks mapped on their own are fresh zero pages, only the smaller ones are cleared
+    inline OwningPointer block_create_zeroed(size_t size, size_t align)
+    {
+        auto bptr = block_create(size, align);
+        if (block_alloc_bytes(bptr) < EASYSPOT_LARGE_BLOCK)
+            memset(bptr, 0, size);
+
+        return bptr;
+    }
+
+    inline void block_destroy(OwningPointer bptr)
+    {
+        auto header = block_header_of(bptr);
+        if ((header & BLOCK_FLAGS) == BLOCK_FILE_FLAGS)
+        {
+            auto size = header_size_of(bptr);
+            seal_saved_file(bptr, size);
+            forget_block_header(bptr);
+            munmap(bptr - page_size(), page_size() + page_round(size));
+            return;
+        }
+
+        auto raw = block_raw_of(bptr);
+        auto bytes = block_alloc_bytes(bptr);
+        forget_block_header(bptr);
+
+        if (!(header & BLOCK_ARENA_FLAG))
+            block_free(raw, bytes);
+    }
+
+    /// Keeps the first bytes, the returned pointer may differ from `bptr`
+    inline OwningPointer block_recreate(OwningPointer bptr, size_t new_size)
+    {
+        auto old_size = header_size_of(bptr);
+        auto header = block_header_of(bptr);
+
+        if ((header & BLOCK_FLAGS) == BLOCK_FILE_FLAGS)
+        {
+            // the file is left as it is, the block moves to the heap
+            auto fresh = block_create(new_size, 1);
+            memcpy(fresh, bptr, std::min(old_size, new_size));
+            block_destroy(bptr);
+            return fresh;
+        }
+
+        auto old_raw = block_raw_of(bptr);
+        auto old_bytes = block_alloc_bytes(bptr);
+        forget_block_header(bptr);
+
+        if (header & BLOCK_ARENA_FLAG)
+        {
+            // the arena keeps the old memory until its reset, the block moves to the heap
+            auto fresh = block_alloc(sizeof(BlockHeader) + new_size) + sizeof(BlockHeader);
+            memcpy(fresh, bptr, std::min(old_size, new_size));
+            write_block_header(fresh, new_size, 0);
+            return fresh;
+        }
+
+        if (header & BLOCK_ALIGNED_FLAG)
+        {
+            // a reallocation would lose the alignment, the block is moved by hand
+            auto align = (size_t)1 << aligned_prefix_of(bptr).align_log2;
+            auto fresh = place_aligned(block_alloc(aligned_alloc_bytes(new_size, align)), new_size, align);
+            memcpy(fresh, bptr, std::min(old_size, new_size));
+            write_block_header(fresh, new_size, BLOCK_ALIGNED_FLAG);
+            block_free(old_raw, old_bytes);
+            return fresh;
+        }
+
+        auto fresh = block_realloc(old_raw, old_bytes, sizeof(BlockHeader) + new_size) + sizeof(BlockHeader);
+        write_block_header(fresh, new_size, 0);
+        return fresh;
+    }
+#endif
+
+
+/// How a file backs a block, writes to a `read_write` one go to the file and are seen by every process mapping it
+enum class map_mode
+{
+    read_only,
+    read_write,
+};
+
+/// The whole file is the block, pages are read from the page cache on first touch and shared with
+/// every other process mapping the same file. Failing to open or map it throws a `std::system_error`
+inline OwningPointer block_create_mapped(cstring path, map_mode mode)
+{
+    auto fd = open(path, mode == map_mode::read_write ? O_RDWR : O_RDONLY);
+    if (fd < 0)
+        throw std::system_error(errno, std::generic_category(), path);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        auto error = errno;
+        close(fd);
+        throw std::system_error(error, std::generic_category(), path);
+    }
+
+    auto prot = mode == map_mode::read_write ? PROT_READ | PROT_WRITE : PROT_READ;
+    auto bptr = block_map_file(fd, 0, st.st_size, prot);
+    auto error = errno;
+
+    // the mapping keeps the file alive
+    close(fd);
+
+    if (bptr == nullptr)
+        throw std::system_error(error, std::generic_category(), path);
+
+    return bptr;
+}
+
+
+/// Files written by `seq::save`: this header at the start, then the elements as they are in memory from
+/// `data_offset`, which is page aligned so loading them back is a single mmap
+struct SeqFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t element_size;
+    uint64_t count;
+    // `checksum64` of the elements
+    uint64_t checksum;
+    uint64_t data_offset;
+};
+
+constexpr char SEQ_FILE_MAGIC[8] = "ESSEQ";
+constexpr uint32_t SEQ_FILE_VERSION = 1;
+
+inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+/// Not cryptographic, 4 independent lanes of multiply-rotate over 8 bytes words, so it runs at memory speed
+inline uint64_t checksum64(void const* data, size_t bytes)
+{
+    constexpr uint64_t P1 = 0x9e3779b185ebca87ull;
+    constexpr uint64_t P2 = 0xc2b2ae3d27d4eb4full;
+    uint64_t lanes[4] = { P1, P2, ~P1, ~P2 };
+    auto bytes_ptr = (uint8_t const*)data;
+    size_t i = 0;
+
+    for (; i + 32 <= bytes; i += 32)
+        for (auto l = 0; l < 4; l++)
+        {
+            uint64_t word;
+            memcpy(&word, bytes_ptr + i + l * 8, 8);
+            lanes[l] = rotl64(lanes[l] ^ (word * P2), 31) * P1;
+        }
+
+    for (; i < bytes; i++)
+        lanes[0] = rotl64(lanes[0] ^ (bytes_ptr[i] * P2), 31) * P1;
+
+    auto hash = (uint64_t)bytes * P1;
+    for (auto l = 0; l < 4; l++)
+        hash = rotl64(hash ^ lanes[l], 27) * P2;
+
+    return hash ^ (hash >> 29);
+}
+
+/// Written to a temporary file renamed over `path` once synced, so a crash never leaves a torn file behind
+inline void save_elements(cstring path, void const* data, size_t element_size, size_t count)
+{
+    auto temp_path = std::string(path) + ".tmp";
+    auto fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        throw std::system_error(errno, std::generic_category(), temp_path);
+
+    // the header is padded to a whole page
+    std::vector<uint8_t> head(page_size(), 0);
+    auto header = (SeqFileHeader*)head.data();
+    memcpy(header->magic, SEQ_FILE_MAGIC, sizeof(SEQ_FILE_MAGIC));
+    header->version = SEQ_FILE_VERSION;
+    header->element_size = element_size;
+    header->count = count;
+    header->checksum = checksum64(data, element_size * count);
+    header->data_offset = head.size();
+
+    auto write_all = [&](void const* bytes, size_t length)
+    {
+        while (length > 0)
+        {
+            auto written = write(fd, bytes, length);
+            if (written < 0 && errno == EINTR)
+                continue;
+
+            if (written <= 0)
+                return false;
+
+            bytes = (uint8_t const*)bytes + written;
+            length -= written;
+        }
+
+        return true;
+    };
+
+    if (!write_all(head.data(), head.size()) || !write_all(data, element_size * count) || fsync(fd) != 0)
+    {
+        auto error = errno;
+        close(fd);
+        unlink(temp_path.c_str());
+        throw std::system_error(error, std::generic_category(), temp_path);
+    }
+
+    close(fd);
+    if (rename(temp_path.c_str(), path) != 0)
+        throw std::system_error(errno, std::generic_category(), path);
+}
+
+/// Header of each saved file loaded `read_write`, mapped shared so the checksum follows the writes to the elements
+std::unordered_map<OwningPointer, SeqFileHeader*> saved_file_headers;
+std::mutex saved_file_headers_lock;
+
+/// Called when a file block is unmapped, the checksum of a `read_write` saved file is brought up to date
+inline void seal_saved_file(OwningPointer bptr, size_t size)
+{
+    SeqFileHeader* header;
+    {
+        std::lock_guard<std::mutex> guard(saved_file_headers_lock);
+        auto it = saved_file_headers.find(bptr);
+        if (it == saved_file_headers.end())
+            return;
+
+        header = it->second;
+        saved_file_headers.erase(it);
+    }
+
+    header->checksum = checksum64(bptr, size);
+    munmap(header, sizeof(SeqFileHeader));
+}
+
+/// Maps the elements of a file written by `seq::save`. The header is checked, a file of another format, version
+/// or element size throws a `std::runtime_error`. The checksum costs a pass over the data, it's only verified in debug mode
+inline OwningPointer block_create_saved(cstring path, size_t element_size, map_mode mode)
+{
+    auto fd = open(path, mode == map_mode::read_write ? O_RDWR : O_RDONLY);
+    if (fd < 0)
+        throw std::system_error(errno, std::generic_category(), path);
+
+    SeqFileHeader header;
+    struct stat st;
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || fstat(fd, &st) != 0)
+    {
+        close(fd);
+        throw std::runtime_error(std::string(path) + ": truncated seq file");
+    }
+
+    auto size = header.count * element_size;
+    if (memcmp(header.magic, SEQ_FILE_MAGIC, sizeof(SEQ_FILE_MAGIC)) != 0
+        || header.version != SEQ_FILE_VERSION
+        || header.element_size != element_size
+        || header.data_offset % page_size() != 0
+        || (size_t)st.st_size < header.data_offset + size)
+    {
+        close(fd);
+        throw std::runtime_error(std::string(path) + ": not a seq file of this version and element size");
+    }
+
+    auto prot = mode == map_mode::read_write ? PROT_READ | PROT_WRITE : PROT_READ;
+    auto bptr = block_map_file(fd, header.data_offset, size, prot);
+    auto error = errno;
+    if (bptr == nullptr)
+    {
+        close(fd);
+        throw std::system_error(error, std::generic_category(), path);
+    }
+
+    #ifdef EASYSPOT_DEBUG
+        if (checksum64(bptr, size) != header.checksum)
+        {
+            close(fd);
+            block_destroy(bptr);
+            throw std::runtime_error(std::string(path) + ": checksum mismatch of the seq file");
+        }
+    #endif
+
+    if (mode == map_mode::read_write)
+    {
+        auto mapped_header = mmap(nullptr, sizeof(SeqFileHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        error = errno;
+        if (mapped_header == MAP_FAILED)
+        {
+            close(fd);
+            block_destroy(bptr);
+            throw std::system_error(error, std::generic_category(), path);
+        }
+
+        std::lock_guard<std::mutex> guard(saved_file_headers_lock);
+        saved_file_headers[bptr] = (SeqFileHeader*)mapped_header;
+    }
+
+    close(fd);
+    return bptr;
+}
+
+
+// race detection mode, fasttrack style: every thread has a vector clock and every 8 bytes granule
+// touched through a `ref` has a shadow with the epoch (clock@thread) of its last write and last read.
+// a granule accessed again by the same thread in the same epoch costs one compare, the full
+// vector clock is only looked at when the accessing thread changes.
+// a non const deref can be a read as well as a write, it is kept aside with a copy of the bytes
+// and only becomes a write when a later access or the next sync point of its thread finds them changed,
+// otherwise it counts as a read.
+// happens-before edges only come from the es:: wrappers (es::thread for now), so threads
+// spawned with plain std::thread look unsynchronized with their parent
+#ifdef EASYSPOT_RACE
+    #ifndef EASYSPOT_MAX_THREADS
+        // threads alive at once seen by the detector, the slot of an exited thread is taken by the next new one
+        #define EASYSPOT_MAX_THREADS 64
+    #endif
+
+    /// Clock in the low 32 bits and thread slot in the high 32 bits, 0 means no access yet
+    using Epoch = uint64_t;
+
+    constexpr Epoch SHARED_READS = UINT64_MAX;
+    constexpr size_t RACE_GRANULE = 8;
+
+    enum RaceAccess : uint8_t
+    {
+        RACE_READ,
+        RACE_WRITE,
+        // non const deref, told apart later by the bytes it leaves
+        RACE_MAYBE_WRITE,
+    };
+    constexpr size_t RACE_SHARDS = 64;
+
+    struct VectorClock
+    {
+        uint32_t clocks[EASYSPOT_MAX_THREADS] = {};
+
+        void join(VectorClock const& other)
+        {
+            for (auto i = 0; i < EASYSPOT_MAX_THREADS; i++)
+                clocks[i] = std::max(clocks[i], other.clocks[i]);
+        }
+    };
+
+    /// Clock carried by a synchronization object, released into and acquired from
+    struct SyncClock
+    {
+        std::mutex lock;
+        VectorClock clock;
+    };
+
+    struct RaceThread
+    {
+        uint32_t slot = UINT32_MAX;
+        VectorClock clock;
+        // clocks of the slot below `first_clock` belong to the threads that had it before,
+        // they only happened before this one up to what it acquired of them
+        uint32_t first_clock = 1;
+        uint32_t acquired_of_slot = 0;
+        // granules of its non const derefs not told apart yet, they are at its next sync point
+        std::vector<uintptr_t> maybe_granules;
+
+        Epoch epoch()
+        {
+            return ((Epoch)slot << 32) | clocks_of_self();
+        }
+
+        uint32_t& clocks_of_self()
+        {
+            return clock.clocks[slot];
+        }
+
+        ~RaceThread();
+    };
+
+    struct RaceShadow
+    {
+        Epoch write = 0;
+        Epoch read = 0;
+        std::unique_ptr<VectorClock> read_clock;
+        // last non const deref not told apart yet, with the bytes [lo, hi) of the granule it saw
+        // and the first read it races with if it turns out to be a write
+        Epoch maybe_write = 0;
+        Epoch maybe_read_conflict = 0;
+        uint64_t maybe_bytes = 0;
+        uint8_t maybe_lo = 0;
+        uint8_t maybe_hi = 0;
+        bool reported = false;
+    };
+
+    struct RaceShard
+    {
+        std::mutex lock;
+        std::unordered_map<uintptr_t, RaceShadow> granules;
+    };
+
+    std::mutex race_slots_lock;
+    uint32_t race_thread_count = 0;
+    std::vector<uint32_t> race_free_slots;
+    // last clock of the thread that left each slot, the next one carries on from there, so the epochs
+    // of the exited thread still in shadows and clocks never look newer than what it did
+    uint32_t race_retired_clocks[EASYSPOT_MAX_THREADS] = {};
+    // first clock of the thread in each slot, older epochs of the slot were from exited threads
+    uint32_t race_first_clocks[EASYSPOT_MAX_THREADS] = {};
+    uint32_t race_kernel_tids[EASYSPOT_MAX_THREADS];
+    RaceShard race_shards[RACE_SHARDS];
+    static thread_local RaceThread race_thread;
+
+    inline void race_resolve_pending(RaceThread& t);
+
+    RaceThread::~RaceThread()
+    {
+        if (slot == UINT32_MAX)
+            return;
+
+        race_resolve_pending(*this);
+        std::lock_guard<std::mutex> guard(race_slots_lock);
+        race_retired_clocks[slot] = clocks_of_self();
+        race_free_slots.push_back(slot);
+    }
+
+    inline RaceThread& current_race_thread()
+    {
+        if (race_thread.slot == UINT32_MAX)
+        {
+            std::lock_guard<std::mutex> guard(race_slots_lock);
+            if (!race_free_slots.empty())
+            {
+                race_thread.slot = race_free_slots.back();
+                race_free_slots.pop_back();
+            }
+            else if (race_thread_count < EASYSPOT_MAX_THREADS)
+                race_thread.slot = race_thread_count++;
+            else
+            {
+                std::cout << "\n[easyspot] Error: more than " << EASYSPOT_MAX_THREADS
+                    << " threads alive at once, raise EASYSPOT_MAX_THREADS\n" << std::flush;
+                std::abort();
+            }
+
+            race_kernel_tids[race_thread.slot] = current_thread_id();
+            race_thread.first_clock = race_retired_clocks[race_thread.slot] + 1;
+            race_first_clocks[race_thread.slot] = race_thread.first_clock;
+            race_thread.clocks_of_self() = race_thread.first_clock;
+        }
+
+        return race_thread;
+    }
+
+    inline uint32_t epoch_slot(Epoch e)
+    {
+        return (uint32_t)(e >> 32);
+    }
+
+    inline uint32_t epoch_clock(Epoch e)
+    {
+        return (uint32_t)e;
+    }
+
+    /// True when `clock` of `slot` happened before the current point of `t`
+    inline bool clock_happened_before(uint32_t slot, uint32_t clock, RaceThread& t)
+    {
+        if (slot == t.slot && clock < t.first_clock)
+            return clock <= t.acquired_of_slot;
+
+        return clock <= t.clock.clocks[slot];
+    }
+
+    /// True when the access at epoch `e` happened before the current point of `t`
+    inline bool happened_before(Epoch e, RaceThread& t)
+    {
+        return clock_happened_before(epoch_slot(e), epoch_clock(e), t);
+    }
+
+    /// Called with the slots lock held
+    inline void print_race_thread(Epoch e)
+    {
+        auto slot = epoch_slot(e);
+        if (epoch_clock(e) < race_first_clocks[slot])
+            std::cout << "a thread that exited since";
+        else
+            std::cout << "thread " << race_kernel_tids[slot];
+    }
+
+    /// `current` is the epoch of the access, a non const deref is only known to be a write at a later point
+    void race_report(uintptr_t address, RaceAccess access, Epoch current, cstring previous_kind, Epoch previous)
+    {
+        cstring kind = access == RACE_READ ? "read" : access == RACE_WRITE ? "write" : "access";
+        auto seen_later = current != current_race_thread().epoch();
+        {
+            std::lock_guard<std::mutex> guard(race_slots_lock);
+            std::cout << "\n[easyspot] Data race on " << (void*)address << ": " << kind << " by ";
+            print_race_thread(current);
+            std::cout << " conflicts with previous " << previous_kind << " by ";
+            print_race_thread(previous);
+            std::cout << "\n";
+
+            if (seen_later)
+                std::cout << "(a non const deref, seen to write here)\n";
+        }
+
+        print_stacktrace();
+    }
+
+    /// Bytes [lo, hi) of the granule, only what the access covers is read so nothing past the block is touched
+    inline uint64_t race_granule_bytes(uintptr_t granule, uint8_t lo, uint8_t hi)
+    {
+        uint64_t bytes = 0;
+        memcpy(&bytes, (void*)(granule + lo), hi - lo);
+        return bytes;
+    }
+
+    /// Adds a read of another thread, whose clock is unknown here, so it is kept in the read clock
+    inline void race_add_read(RaceShadow& s, Epoch e)
+    {
+        if (s.read == 0 || (s.read != SHARED_READS && epoch_slot(s.read) == epoch_slot(e)))
+        {
+            s.read = std::max(s.read, e);
+            return;
+        }
+
+        if (s.read != SHARED_READS)
+        {
+            s.read_clock = std::make_unique<VectorClock>();
+            s.read_clock->clocks[epoch_slot(s.read)] = epoch_clock(s.read);
+            s.read = SHARED_READS;
+        }
+
+        auto& clock = s.read_clock->clocks[epoch_slot(e)];
+        clock = std::max(clock, epoch_clock(e));
+    }
+
+    /// First read of `s` that did not happen before the current point of `t`, 0 if none
+    inline Epoch race_read_conflict(RaceShadow& s, RaceThread& t)
+    {
+        if (s.read == SHARED_READS)
+        {
+            for (uint32_t i = 0; i < EASYSPOT_MAX_THREADS; i++)
+                if (!clock_happened_before(i, s.read_clock->clocks[i], t))
+                    return ((Epoch)i << 32) | s.read_clock->clocks[i];
+
+            return 0;
+        }
+
+        return s.read != 0 && !happened_before(s.read, t) ? s.read : 0;
+    }
+
+    /// The pending non const deref of `s` wrote if the bytes changed since, else it only read.
+    /// As a write it races with the reads it was found to race with when it happened
+    inline void race_resolve(uintptr_t granule, RaceShadow& s)
+    {
+        if (s.maybe_write == 0)
+            return;
+
+        if (race_granule_bytes(granule, s.maybe_lo, s.maybe_hi) == s.maybe_bytes)
+            race_add_read(s, s.maybe_write);
+        else
+        {
+            if (s.maybe_read_conflict != 0 && !s.reported)
+            {
+                s.reported = true;
+                race_report(granule, RACE_WRITE, s.maybe_write, "read", s.maybe_read_conflict);
+            }
+
+            // the write is ordered after every read that did not race, they can be forgotten
+            s.read = 0;
+            s.read_clock.reset();
+            s.write = s.maybe_write;
+        }
+
+        s.maybe_write = 0;
+    }
+
+    /// A granule never accessed again would keep the write of its non const deref unchecked
+    inline void race_resolve_pending(RaceThread& t)
+    {
+        auto e = t.epoch();
+        for (auto granule : t.maybe_granules)
+        {
+            auto& shard = race_shards[(granule / RACE_GRANULE) % RACE_SHARDS];
+            std::lock_guard<std::mutex> guard(shard.lock);
+            auto it = shard.granules.find(granule);
+            if (it != shard.granules.end() && it->second.maybe_write == e)
+                race_resolve(granule, it->second);
+        }
+
+        t.maybe_granules.clear();
+    }
+
+    inline void race_check_granule(uintptr_t granule, uintptr_t first, uintptr_t last, RaceAccess access)
+    {
+        auto& t = current_race_thread();
+        auto e = t.epoch();
+        auto& shard = race_shards[(granule / RACE_GRANULE) % RACE_SHARDS];
+        std::lock_guard<std::mutex> guard(shard.lock);
+        auto& s = shard.granules[granule];
+
+        // before the same epoch shortcut, a pending write may race with reads nobody checked yet
+        auto pending_here = s.maybe_write == e;
+        race_resolve(granule, s);
+
+        // same epoch, nothing new can be learnt
+        if ((access == RACE_WRITE && s.write == e) || (access == RACE_READ && s.read == e))
+            return;
+
+        cstring conflict = nullptr;
+        Epoch conflict_epoch = 0;
+
+        if (s.write != 0 && !happened_before(s.write, t))
+        {
+            conflict = "write";
+            conflict_epoch = s.write;
+        }
+
+        if (access == RACE_MAYBE_WRITE)
+        {
+            // it may be a read, so the reads before it are only conflicts once it is seen to write
+            s.maybe_write = e;
+            s.maybe_read_conflict = race_read_conflict(s, t);
+            s.maybe_lo = (uint8_t)(std::max(granule, first) - granule);
+            s.maybe_hi = (uint8_t)(std::min(granule + RACE_GRANULE, last) - granule);
+            s.maybe_bytes = race_granule_bytes(granule, s.maybe_lo, s.maybe_hi);
+            if (!pending_here)
+                t.maybe_granules.push_back(granule);
+        }
+        else if (access == RACE_WRITE)
+        {
+            auto read = race_read_conflict(s, t);
+            if (read != 0 && conflict == nullptr)
+            {
+                conflict = "read";
+                conflict_epoch = read;
+            }
+
+            // the write is ordered after every read that did not race, they can be forgotten
+            s.read = 0;
+            s.read_clock.reset();
+            s.write = e;
+        }
+        else if (s.read == SHARED_READS)
+        {
+            s.read_clock->clocks[t.slot] = t.clocks_of_self();
+        }
+        else if (s.read == 0 || happened_before(s.read, t))
+        {
+            s.read = e;
+        }
+        else
+        {
+            // concurrent readers, from now on all of them are tracked
+            s.read_clock = std::make_unique<VectorClock>();
+            s.read_clock->clocks[epoch_slot(s.read)] = epoch_clock(s.read);
+            s.read_clock->clocks[t.slot] = t.clocks_of_self();
+            s.read = SHARED_READS;
+        }
+
+        if (conflict != nullptr && !s.reported)
+        {
+            s.reported = true;
+            race_report(granule, access, e, conflict, conflict_epoch);
+        }
+    }
+
+    inline void race_check(void* ptr, size_t size, RaceAccess access)
+    {
+        auto first = (uintptr_t)ptr;
+        auto last = first + size;
+        for (auto g = first & ~(uintptr_t)(RACE_GRANULE - 1); g < last; g += RACE_GRANULE)
+            race_check_granule(g, first, last, access);
+    }
+
+    /// Dropped memory can be reused by an unrelated block, its shadow must go with it
+    inline void race_forget(void* ptr, size_t size)
+    {
+        auto first = (uintptr_t)ptr & ~(uintptr_t)(RACE_GRANULE - 1);
+        auto last = (uintptr_t)ptr + size;
+
+        for (auto& shard : race_shards)
+        {
+            std::lock_guard<std::mutex> guard(shard.lock);
+
+            // small blocks are erased granule by granule, big ones with a sweep of the table
+            if ((last - first) / RACE_GRANULE <= shard.granules.size())
+            {
+                auto shard_idx = &shard - race_shards;
+                for (auto g = first; g < last; g += RACE_GRANULE)
+                    if ((g / RACE_GRANULE) % RACE_SHARDS == (uintptr_t)shard_idx)
+                        shard.granules.erase(g);
+            }
+            else
+            {
+                for (auto it = shard.granules.begin(); it != shard.granules.end();)
+                    it = it->first >= first && it->first < last ? shard.granules.erase(it) : std::next(it);
+            }
+        }
+    }
+
+    /// Everything the current thread did so far happens before a later `race_acquire` of `sync`
+    inline void race_release(SyncClock& sync)
+    {
+        auto& t = current_race_thread();
+        race_resolve_pending(t);
+        {
+            std::lock_guard<std::mutex> guard(sync.lock);
+            sync.clock.join(t.clock);
+        }
+
+        t.clocks_of_self()++;
+    }
+
+    inline void race_acquire(SyncClock& sync)
+    {
+        auto& t = current_race_thread();
+        race_resolve_pending(t);
+        std::lock_guard<std::mutex> guard(sync.lock);
+        t.acquired_of_slot = std::max(t.acquired_of_slot, sync.clock.clocks[t.slot]);
+        t.clock.join(sync.clock);
+    }
+
+    #define RACE_CHECK(ptr, size, access) race_check(ptr, size, access)
+    #define RACE_FORGET(ptr, size) race_forget(ptr, size)
+
+    namespace es
+    {
+        /// `std::thread` that tells the race detector the child starts after everything
+        /// the parent did before spawning it, and `join()` the opposite
+        struct thread
+        {
+            std::unique_ptr<SyncClock> start;
+            std::unique_ptr<SyncClock> finish;
+            std::thread handle;
+
+            template<typename F, typename... Args>
+            explicit thread(F&& f, Args&&... args)
+                : start(std::make_unique<SyncClock>()), finish(std::make_unique<SyncClock>())
+            {
+                race_release(*start);
+
+                auto start_ptr = start.get();
+                auto finish_ptr = finish.get();
+                handle = std::thread(
+                    [=](auto&& f, auto&&... args)
+                    {
+                        race_acquire(*start_ptr);
+                        f(args...);
+                        race_release(*finish_ptr);
+                    },
+                    std::forward<F>(f), std::forward<Args>(args)...
+                );
+            }
+
+            void join()
+            {
+                handle.join();
+                race_acquire(*finish);
+            }
+
+            bool joinable()
+            {
+                return handle.joinable();
+            }
+        };
+    }
+#else
+    #define RACE_CHECK(ptr, size, access) ;
+    #define RACE_FORGET(ptr, size) ;
+
+    namespace es
+    {
+        using thread = std::thread;
+    }
+#endif
+
+
+// synchronization wrappers, `es::mutex`, `es::shared_mutex` and `es::atomic<T>` behave like the std ones.
+// with `EASYSPOT_RACE` they feed acquire/release edges to the race detector, with `EASYSPOT_LOCK_PROFILE`
+// every acquisition records its wait and hold time per call site, in a buffer owned by the thread,
+// with `EASYSPOT_LOCK_ORDER` acquisitions build a global lock order graph and cycles are reported as
+// potential deadlocks, even when the run never actually deadlocks. with none of the modes they are plain aliases of the std types
+#if defined(EASYSPOT_RACE) || defined(EASYSPOT_LOCK_PROFILE) || defined(EASYSPOT_LOCK_ORDER)
+    #define EASYSPOT_INSTRUMENT_LOCKS
+#endif
+
+#ifdef EASYSPOT_INSTRUMENT_LOCKS
+    #ifndef EASYSPOT_MAX_HELD_LOCKS
+        #define EASYSPOT_MAX_HELD_LOCKS 32
+    #endif
+
+    inline uint64_t lock_now_ns()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    }
+
+    struct HeldLock
+    {
+        void* lock;
+        uint64_t id;
+        void* site;
+        uint64_t acquired_ns;
+    };
+
+    /// Locks the thread is holding right now, in acquisition order
+    struct HeldLocks
+    {
+        HeldLock locks[EASYSPOT_MAX_HELD_LOCKS];
+        uint32_t count = 0;
+    };
+
+    static thread_local HeldLocks held_locks;
+    std::atomic<uint64_t> next_lock_id { 1 };
+
+    #ifdef EASYSPOT_LOCK_PROFILE
+        constexpr size_t LOCK_PROFILE_SITES = 256;
+
+        struct LockSiteStats
+        {
+            // only the owning thread writes, the reporter reads them relaxed
+            std::atomic<void*> site { nullptr };
+            std::atomic<uint64_t> acquisitions { 0 };
+            std::atomic<uint64_t> contended { 0 };
+            std::atomic<uint64_t> wait_ns { 0 };
+            std::atomic<uint64_t> max_wait_ns { 0 };
+            std::atomic<uint64_t> hold_ns { 0 };
+        };
+
+        /// Per thread open addressing table of sites, the last slot collects whatever doesn't fit.
+        /// Buffers are never freed, so the stats of finished threads are still reported
+        struct LockProfileBuffer
+        {
+            LockSiteStats sites[LOCK_PROFILE_SITES];
+            LockProfileBuffer* next = nullptr;
+
+            LockSiteStats& stats_of(void* site)
+            {
+                auto start = ((uintptr_t)site >> 4) % (LOCK_PROFILE_SITES - 1);
+                for (size_t i = 0; i < LOCK_PROFILE_SITES - 1; i++)
+                {
+                    auto& s = sites[(start + i) % (LOCK_PROFILE_SITES - 1)];
+                    auto current = s.site.load(std::memory_order_relaxed);
+                    if (current == site)
+                        return s;
+
+                    if (current == nullptr)
+                    {
+                        s.site.store(site, std::memory_order_relaxed);
+                        return s;
+                    }
+                }
+
+                return sites[LOCK_PROFILE_SITES - 1];
+            }
+        };
+
+        std::mutex lock_profile_buffers_lock;
+        LockProfileBuffer* lock_profile_buffers = nullptr;
+        static thread_local LockProfileBuffer* lock_profile_buffer = nullptr;
+
+        inline void bump(std::atomic<uint64_t>& counter, uint64_t amount)
+        {
+            counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+        }
+
+        inline LockSiteStats& lock_site_stats(void* site)
+        {
+            if (lock_profile_buffer == nullptr)
+            {
+                lock_profile_buffer = new LockProfileBuffer();
+                std::lock_guard<std::mutex> guard(lock_profile_buffers_lock);
+                lock_profile_buffer->next = lock_profile_buffers;
+                lock_profile_buffers = lock_profile_buffer;
+            }
+
+            return lock_profile_buffer->stats_of(site);
+        }
+    #endif
+
+    #ifdef EASYSPOT_LOCK_ORDER
+        constexpr int LOCK_ORDER_FRAMES = 16;
+        constexpr size_t LOCK_ORDER_CACHE = 256;
+
+        /// "`from` was held while `to` was acquired", with the stack of that acquisition
+        struct LockOrderEdge
+        {
+            uint64_t to;
+            void* frames[LOCK_ORDER_FRAMES];
+            int frame_count;
+        };
+
+        /// Nodes are lock ids and not addresses, a lock allocated where a destroyed one lived starts clean
+        std::mutex lock_order_graph_lock;
+        std::unordered_map<uint64_t, std::vector<LockOrderEdge>> lock_order_graph;
+
+        /// Direct mapped cache of edges this thread already put in the graph,
+        /// a hit skips the global lock so known orders cost a couple of loads
+        struct LockOrderCache
+        {
+            uint64_t from[LOCK_ORDER_CACHE] = {};
+            uint64_t to[LOCK_ORDER_CACHE] = {};
+        };
+
+        static thread_local LockOrderCache lock_order_cache;
+
+        /// Path of edges from `start` to `goal`, empty when there is none
+        std::vector<LockOrderEdge const*> lock_order_path(uint64_t start, uint64_t goal)
+        {
+            // node -> (node it was reached from, edge used)
+            std::unordered_map<uint64_t, std::pair<uint64_t, LockOrderEdge const*>> reached_by;
+            std::vector<uint64_t> stack = { start };
+            reached_by[start] = { start, nullptr };
+
+            while (!stack.empty())
+            {
+                auto node = stack.back();
+                stack.pop_back();
+
+                auto it = lock_order_graph.find(node);
+                if (it == lock_order_graph.end())
+                    continue;
+
+                for (auto& edge : it->second)
+                {
+                    if (reached_by.count(edge.to) != 0)
+                        continue;
+
+                    reached_by[edge.to] = { node, &edge };
+                    if (edge.to != goal)
+                    {
+                        stack.push_back(edge.to);
+                        continue;
+                    }
+
+                    std::vector<LockOrderEdge const*> path;
+                    for (auto at = goal; at != start; at = reached_by[at].first)
+                        path.insert(path.begin(), reached_by[at].second);
+
+                    return path;
+                }
+            }
+
+            return {};
+        }
+
+        void lock_order_report(uint64_t held, uint64_t acquired, std::vector<LockOrderEdge const*> const& path)
+        {
+            std::cout
+                << "\n[easyspot] Potential deadlock: lock #" << acquired << " acquired while holding lock #" << held
+                << ", but elsewhere lock #" << held << " was acquired after lock #" << acquired << "\n"
+                << "\nAcquisition of lock #" << acquired << " here:\n";
+
+            print_stacktrace();
+
+            for (auto edge : path)
+            {
+                std::cout << "Earlier acquisition of lock #" << edge->to << ":\n";
+                print_frames((void**)edge->frames, edge->frame_count);
+            }
+        }
+
+        /// Runs before blocking on `id`, so a lock order that is about to deadlock is still reported
+        inline void lock_order_check(void* lock, uint64_t id)
+        {
+            for (uint32_t i = 0; i < held_locks.count; i++)
+            {
+                auto held = held_locks.locks[i].id;
+                if (held_locks.locks[i].lock == lock)
+                {
+                    std::cout << "\n[easyspot] Deadlock: lock #" << id << " acquired again by the thread holding it\n";
+                    print_stacktrace();
+                    continue;
+                }
+
+                auto slot = (held * 31 + id) % LOCK_ORDER_CACHE;
+                if (lock_order_cache.from[slot] == held && lock_order_cache.to[slot] == id)
+                    continue;
+
+                std::lock_guard<std::mutex> guard(lock_order_graph_lock);
+                auto& edges = lock_order_graph[held];
+                auto known = std::any_of(edges.begin(), edges.end(), [&](auto& e) { return e.to == id; });
+
+                if (!known)
+                {
+                    // a new edge closes a cycle only if its target already reaches its source
+                    auto path = lock_order_path(id, held);
+
+                    // reporting first, the path points into edge vectors the push can reallocate
+                    if (!path.empty())
+                        lock_order_report(held, id, path);
+
+                    LockOrderEdge edge = { .to = id };
+                    edge.frame_count = backtrace(edge.frames, LOCK_ORDER_FRAMES);
+                    edges.push_back(edge);
+                }
+
+                lock_order_cache.from[slot] = held;
+                lock_order_cache.to[slot] = id;
+            }
+        }
+    #endif
+
+    /// Blocks on the lock, timing the wait only when the fast `try_lock` fails
+    template<typename TryF, typename LockF>
+    inline void instrumented_lock(void* lock, uint64_t id, void* site, TryF try_lock, LockF lock_fn)
+    {
+        #ifdef EASYSPOT_LOCK_ORDER
+            lock_order_check(lock, id);
+        #endif
+
+        #ifdef EASYSPOT_LOCK_PROFILE
+            auto start_ns = lock_now_ns();
+            uint64_t wait_ns = 0;
+
+            if (!try_lock())
+            {
+                lock_fn();
+                wait_ns = lock_now_ns() - start_ns;
+            }
+
+            auto& stats = lock_site_stats(site);
+            bump(stats.acquisitions, 1);
+            if (wait_ns > 0)
+            {
+                bump(stats.contended, 1);
+                bump(stats.wait_ns, wait_ns);
+                if (wait_ns > stats.max_wait_ns.load(std::memory_order_relaxed))
+                    stats.max_wait_ns.store(wait_ns, std::memory_order_relaxed);
+            }
+
+            auto acquired_ns = start_ns + wait_ns;
+        #else
+            lock_fn();
+            uint64_t acquired_ns = 0;
+        #endif
+
+        if (held_locks.count < EASYSPOT_MAX_HELD_LOCKS)
+            held_locks.locks[held_locks.count++] = HeldLock { .lock = lock, .id = id, .site = site, .acquired_ns = acquired_ns };
+    }
+
+    inline void instrumented_try_locked(void* lock, uint64_t id, void* site)
+    {
+        #ifdef EASYSPOT_LOCK_PROFILE
+            bump(lock_site_stats(site).acquisitions, 1);
+            auto acquired_ns = lock_now_ns();
+        #else
+            uint64_t acquired_ns = 0;
+        #endif
+
+        if (held_locks.count < EASYSPOT_MAX_HELD_LOCKS)
+            held_locks.locks[held_locks.count++] = HeldLock { .lock = lock, .id = id, .site = site, .acquired_ns = acquired_ns };
+    }
+
+    /// Locks are not always released in reverse order, so the held one is searched from the top
+    inline void instrumented_unlock(void* lock)
+    {
+        for (auto i = (int)held_locks.count - 1; i >= 0; i--)
+        {
+            if (held_locks.locks[i].lock != lock)
+                continue;
+
+            #ifdef EASYSPOT_LOCK_PROFILE
+                auto& held = held_locks.locks[i];
+                bump(lock_site_stats(held.site).hold_ns, lock_now_ns() - held.acquired_ns);
+            #endif
+
+            for (auto j = i; j + 1 < (int)held_locks.count; j++)
+                held_locks.locks[j] = held_locks.locks[j + 1];
+
+            held_locks.count--;
+            return;
+        }
+    }
+
+    namespace es
+    {
+        struct mutex
+        {
+            std::mutex native;
+            uint64_t id = next_lock_id.fetch_add(1, std::memory_order_relaxed);
+
+            #ifdef EASYSPOT_RACE
+                SyncClock sync;
+            #endif
+
+            // not inlined, so the return address is the acquisition site
+            __attribute__((noinline)) void lock()
+            {
+                instrumented_lock(
+                    this, id, __builtin_return_address(0),
+                    [&] { return native.try_lock(); }, [&] { native.lock(); }
+                );
+
+                #ifdef EASYSPOT_RACE
+                    race_acquire(sync);
+                #endif
+            }
+
+            __attribute__((noinline)) bool try_lock()
+            {
+                if (!native.try_lock())
+                    return false;
+
+                instrumented_try_locked(this, id, __builtin_return_address(0));
+                #ifdef EASYSPOT_RACE
+                    race_acquire(sync);
+                #endif
+
+                return true;
+            }
+
+            void unlock()
+            {
+                #ifdef EASYSPOT_RACE
+                    race_release(sync);
+                #endif
+
+                instrumented_unlock(this);
+                native.unlock();
+            }
+        };
+
+        /// Readers release into their own clock, so a writer is ordered after all the readers before it,
+        /// while readers are only ordered after writers
+        struct shared_mutex
+        {
+            std::shared_mutex native;
+            uint64_t id = next_lock_id.fetch_add(1, std::memory_order_relaxed);
+
+            #ifdef EASYSPOT_RACE
+                SyncClock writers;
+                SyncClock readers;
+            #endif
+
+            __attribute__((noinline)) void lock()
+            {
+                instrumented_lock(
+                    this, id, __builtin_return_address(0),
+                    [&] { return native.try_lock(); }, [&] { native.lock(); }
+                );
+
+                #ifdef EASYSPOT_RACE
+                    race_acquire(writers);
+                    race_acquire(readers);
+                #endif
+            }
+
+            __attribute__((noinline)) bool try_lock()
+            {
+                if (!native.try_lock())
+                    return false;
+
+                instrumented_try_locked(this, id, __builtin_return_address(0));
+                #ifdef EASYSPOT_RACE
+                    race_acquire(writers);
+                    race_acquire(readers);
+                #endif
+
+                return true;
+            }
+
+            void unlock()
+            {
+                #ifdef EASYSPOT_RACE
+                    race_release(writers);
+                #endif
+
+                instrumented_unlock(this);
+                native.unlock();
+            }
+
+            __attribute__((noinline)) void lock_shared()
+            {
+                instrumented_lock(
+                    this, id, __builtin_return_address(0),
+                    [&] { return native.try_lock_shared(); }, [&] { native.lock_shared(); }
+                );
+
+                #ifdef EASYSPOT_RACE
+                    race_acquire(writers);
+                #endif
+            }
+
+            __attribute__((noinline)) bool try_lock_shared()
+            {
+                if (!native.try_lock_shared())
+                    return false;
+
+                instrumented_try_locked(this, id, __builtin_return_address(0));
+                #ifdef EASYSPOT_RACE
+                    race_acquire(writers);
+                #endif
+
+                return true;
+            }
+
+            void unlock_shared()
+            {
+                #ifdef EASYSPOT_RACE
+                    race_release(readers);
+                #endif
+
+                instrumented_unlock(this);
+                native.unlock_shared();
+            }
+        };
+
+        #ifdef EASYSPOT_LOCK_PROFILE
+            /// Sums the buffers of every thread and prints the sites sorted by total wait time
+            void lock_profile_report()
+            {
+                struct Row
+                {
+                    void* site;
+                    uint64_t acquisitions, contended, wait_ns, max_wait_ns, hold_ns;
+                };
+
+                std::vector<Row> rows;
+                {
+                    std::lock_guard<std::mutex> guard(lock_profile_buffers_lock);
+                    for (auto buffer = lock_profile_buffers; buffer != nullptr; buffer = buffer->next)
+                        for (auto& s : buffer->sites)
+                        {
+                            auto site = s.site.load(std::memory_order_relaxed);
+                            auto acquisitions = s.acquisitions.load(std::memory_order_relaxed);
+                            if (acquisitions == 0)
+                                continue;
+
+                            auto it = std::find_if(rows.begin(), rows.end(), [&](auto& r) { return r.site == site; });
+                            if (it == rows.end())
+                                it = rows.insert(rows.end(), Row { .site = site });
+
+                            it->acquisitions += acquisitions;
+                            it->contended += s.contended.load(std::memory_order_relaxed);
+                            it->wait_ns += s.wait_ns.load(std::memory_order_relaxed);
+                            it->max_wait_ns = std::max(it->max_wait_ns, s.max_wait_ns.load(std::memory_order_relaxed));
+                            it->hold_ns += s.hold_ns.load(std::memory_order_relaxed);
+                        }
+                }
+
+                std::sort(rows.begin(), rows.end(), [](auto& a, auto& b) { return a.wait_ns > b.wait_ns; });
+
+                std::cout << "\n[easyspot] Lock profile, sorted by total wait\n";
+                for (auto& r : rows)
+                    std::cout
+                        << " ↳ " << describe_site(r.site) << "\n"
+                        << "    acquisitions: " << r.acquisitions
+                        << ", contended: " << r.contended
+                        << ", wait: " << r.wait_ns / 1000 << "us (max " << r.max_wait_ns / 1000 << "us)"
+                        << ", hold: " << r.hold_ns / 1000 << "us\n";
+
+                std::cout << std::flush;
+            }
+        #endif
+    }
+#else
+    namespace es
+    {
+        using mutex = std::mutex;
+        using shared_mutex = std::shared_mutex;
+    }
+#endif
+
+namespace es
+{
+    #ifdef EASYSPOT_RACE
+        /// Stores release the clock of the writer, loads acquire it, read-modify-writes do both.
+        /// Only the orders that actually synchronize create an edge
+        template<typename T>
+        struct atomic
+        {
+            std::atomic<T> native;
+            SyncClock sync;
+
+            atomic() = default;
+
+            atomic(T desired) : native(desired)
+            {
+
+            }
+
+            atomic(atomic const&) = delete;
+            atomic& operator=(atomic const&) = delete;
+
+            static bool releases(std::memory_order order)
+            {
+                return order == std::memory_order_release || order == std::memory_order_acq_rel
+                    || order == std::memory_order_seq_cst;
+            }
+
+            static bool acquires(std::memory_order order)
+            {
+                return order == std::memory_order_acquire || order == std::memory_order_acq_rel
+                    || order == std::memory_order_consume || order == std::memory_order_seq_cst;
+            }
+
+            void store(T desired, std::memory_order order = std::memory_order_seq_cst)
+            {
+                if (releases(order))
+                    race_release(sync);
+
+                native.store(desired, order);
+            }
+
+            T load(std::memory_order order = std::memory_order_seq_cst) const
+            {
+                auto value = native.load(order);
+                if (acquires(order))
+                    race_acquire(const_cast<SyncClock&>(sync));
+
+                return value;
+            }
+
+            /// Applies a read-modify-write `op` on the native atomic with the edges of `order`
+            template<typename OpF>
+            auto rmw(std::memory_order order, OpF op)
+            {
+                if (releases(order))
+                    race_release(sync);
+
+                auto result = op();
+                if (acquires(order))
+                    race_acquire(sync);
+
+                return result;
+            }
+
+            T exchange(T desired, std::memory_order order = std::memory_order_seq_cst)
+            {
+                return rmw(order, [&] { return native.exchange(desired, order); });
+            }
+
+            bool compare_exchange_strong(T& expected, T desired, std::memory_order order = std::memory_order_seq_cst)
+            {
+                return rmw(order, [&] { return native.compare_exchange_strong(expected, desired, order); });
+            }
+
+            bool compare_exchange_weak(T& expected, T desired, std::memory_order order = std::memory_order_seq_cst)
+            {
+                return rmw(order, [&] { return native.compare_exchange_weak(expected, desired, order); });
+            }
+
+            T fetch_add(T arg, std::memory_order order = std::memory_order_seq_cst)
+            {
+                return rmw(order, [&] { return native.fetch_add(arg, order); });
+            }
+
+            T fetch_sub(T arg, std::memory_order order = std::memory_order_seq_cst)
+            {
+                return rmw(order, [&] { return native.fetch_sub(arg, order); });
+            }
+
+            T fetch_and(T arg, std::memory_order order = std::memory_order_seq_cst)
+            {
+                return rmw(order, [&] { return native.fetch_and(arg, order); });
+            }
+
+            T fetch_or(T arg, std::memory_order order = std::memory_order_seq_cst)
+            {
+                return rmw(order, [&] { return native.fetch_or(arg, order); });
+            }
+
+            T fetch_xor(T arg, std::memory_order order = std::memory_order_seq_cst)
+            {
+                return rmw(order, [&] { return native.fetch_xor(arg, order); });
+            }
+
+            operator T() const
+            {
+                return load();
+            }
+
+            T operator=(T desired)
+            {
+                store(desired);
+                return desired;
+            }
+        };
+    #else
+        template<typename T>
+        using atomic = std::atomic<T>;
+    #endif
+}
+
+
+// shared among all threads, since different threads can use the same memory,
+// every access to it goes through `debug_mem_registry_lock`
+/// `owner` of a shared block
+constexpr uint32_t NO_OWNER = 0;
+
+constexpr int ALLOC_SITE_FRAMES = 8;
+
+
+/// Layout of the registry mirror file, read back by tools/registry after a crash.
+/// The header is followed by `record_capacity` records, then `site_capacity` sites, then `module_capacity` modules,
+/// each array starting at the offset written in the header
+struct RegistryMirrorHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t pid;
+    uint64_t record_capacity;
+    uint64_t site_capacity;
+    uint64_t module_capacity;
+    uint64_t records_offset;
+    uint64_t sites_offset;
+    uint64_t modules_offset;
+    // records past the capacity are not mirrored, then this is set
+    volatile uint64_t overflowed;
+    volatile uint64_t record_count;
+    volatile uint64_t module_count;
+};
+
+/// Same index as the record in `debug_mem_registry`
+struct RegistryMirrorRecord
+{
+    // 0 for a tombstone, a slot whose block was past the capacity and never mirrored
+    uint64_t address;
+    uint64_t size;
+    // id of the allocation site, its slot is `site - 1`
+    uint32_t site;
+    uint16_t generation;
+    uint16_t reserved;
+};
+
+/// Frames as offsets in their module, so they mean something once the process is gone
+struct RegistryMirrorSite
+{
+    uint64_t offsets[ALLOC_SITE_FRAMES];
+    uint16_t modules[ALLOC_SITE_FRAMES];
+    uint32_t frame_count;
+};
+
+struct RegistryMirrorModule
+{
+    char path[256];
+};
+
+constexpr char REGISTRY_MIRROR_MAGIC[8] = "ESREG";
+constexpr uint32_t REGISTRY_MIRROR_VERSION = 1;
+
+
+// registry mirror mode, every change of the debug registry is also written to a file mapped shared,
+// so the live blocks and their allocation sites survive a crash of the process (tools/registry reads it).
+// a change costs a few stores, an allocation site is resolved to module + offset once when first seen
+#ifdef EASYSPOT_REGISTRY_MIRROR
+    #ifndef EASYSPOT_DEBUG
+        #error "EASYSPOT_REGISTRY_MIRROR needs EASYSPOT_DEBUG, it mirrors the registry"
+    #endif
+
+    #ifndef EASYSPOT_REGISTRY_MIRROR_DIR
+        #define EASYSPOT_REGISTRY_MIRROR_DIR "."
+    #endif
+
+    #ifndef EASYSPOT_REGISTRY_MIRROR_CAPACITY
+        // live blocks mirrored, the file is sparse so only the slots used cost disk
+        #define EASYSPOT_REGISTRY_MIRROR_CAPACITY (1 << 22)
+    #endif
+
+    constexpr size_t REGISTRY_MIRROR_SITES = 1 << 16;
+    constexpr size_t REGISTRY_MIRROR_MODULES = 256;
+
+    struct RegistryMirror
+    {
+        RegistryMirrorHeader* header = nullptr;
+        RegistryMirrorRecord* records = nullptr;
+        RegistryMirrorSite* sites = nullptr;
+        RegistryMirrorModule* modules = nullptr;
+        std::once_flag opened;
+
+        /// Creates the file on the first write, writes are dropped if that fails
+        bool ready()
+        {
+            std::call_once(opened, [this] { open(); });
+            return header != nullptr;
+        }
+
+        void open()
+        {
+            char path[512];
+            snprintf(path, sizeof(path), "%s/easyspot-%d.registry", EASYSPOT_REGISTRY_MIRROR_DIR, (int)getpid());
+
+            auto records_offset = (sizeof(RegistryMirrorHeader) + 63) & ~(size_t)63;
+            auto sites_offset = records_offset + EASYSPOT_REGISTRY_MIRROR_CAPACITY * sizeof(RegistryMirrorRecord);
+            auto modules_offset = sites_offset + REGISTRY_MIRROR_SITES * sizeof(RegistryMirrorSite);
+            auto mapped_bytes = modules_offset + REGISTRY_MIRROR_MODULES * sizeof(RegistryMirrorModule);
+
+            auto fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0 || ftruncate(fd, mapped_bytes) != 0)
+            {
+                if (fd >= 0)
+                    close(fd);
+
+                return;
+            }
+
+            // never unmapped, the mirror must stay valid until the very end of the process
+            auto mapping = mmap(nullptr, mapped_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            close(fd);
+            if (mapping == MAP_FAILED)
+                return;
+
+            auto base = (uint8_t*)mapping;
+            records = (RegistryMirrorRecord*)(base + records_offset);
+            sites = (RegistryMirrorSite*)(base + sites_offset);
+            modules = (RegistryMirrorModule*)(base + modules_offset);
+
+            auto h = (RegistryMirrorHeader*)base;
+            memcpy(h->magic, REGISTRY_MIRROR_MAGIC, sizeof(REGISTRY_MIRROR_MAGIC));
+            h->version = REGISTRY_MIRROR_VERSION;
+            h->pid = getpid();
+            h->record_capacity = EASYSPOT_REGISTRY_MIRROR_CAPACITY;
+            h->site_capacity = REGISTRY_MIRROR_SITES;
+            h->module_capacity = REGISTRY_MIRROR_MODULES;
+            h->records_offset = records_offset;
+            h->sites_offset = sites_offset;
+            h->modules_offset = modules_offset;
+            header = h;
+        }
+
+        /// Called with the registry lock held
+        void write(size_t idx, OwningPointer block, size_t size, uint32_t site, uint16_t generation)
+        {
+            if (!ready())
+                return;
+
+            if (idx >= header->record_capacity)
+            {
+                header->overflowed = 1;
+                return;
+            }
+
+            records[idx] = RegistryMirrorRecord { .address = (uint64_t)block, .size = size, .site = site, .generation = generation };
+        }
+
+        /// Called with the registry lock held, mirrors the swap with the last record before a pop.
+        /// A record past the capacity was never written, `to` becomes a tombstone instead of keeping the dropped block
+        void move(size_t from, size_t to)
+        {
+            if (!ready() || to >= header->record_capacity)
+                return;
+
+            records[to] = from < header->record_capacity ? records[from] : RegistryMirrorRecord {};
+        }
+
+        /// The count is published after the records it covers, so a crash never exposes an unwritten one
+        void count(size_t count)
+        {
+            if (ready())
+                __atomic_store_n(&header->record_count, std::min<uint64_t>(count, header->record_capacity), __ATOMIC_RELEASE);
+        }
+
+        /// Called with the alloc sites lock held, once per new site
+        void site(uint32_t id, void* const* frames, int frame_count)
+        {
+            if (!ready() || id == 0 || id > REGISTRY_MIRROR_SITES)
+                return;
+
+            auto& mirrored = sites[id - 1];
+            for (auto i = 0; i < frame_count; i++)
+            {
+                Dl_info info;
+                if (dladdr(frames[i], &info) == 0 || info.dli_fname == nullptr)
+                {
+                    // unknown module, the absolute address is kept
+                    mirrored.modules[i] = UINT16_MAX;
+                    mirrored.offsets[i] = (uint64_t)frames[i];
+                    continue;
+                }
+
+                mirrored.modules[i] = module_index(info.dli_fname);
+                mirrored.offsets[i] = (uint64_t)frames[i] - (uint64_t)info.dli_fbase;
+            }
+
+            mirrored.frame_count = frame_count;
+        }
+
+        uint16_t module_index(cstring path)
+        {
+            auto count = header->module_count;
+            for (size_t i = 0; i < count; i++)
+                if (strncmp(modules[i].path, path, sizeof(modules[i].path)) == 0)
+                    return i;
+
+            if (count == header->module_capacity)
+                return UINT16_MAX;
+
+            snprintf(modules[count].path, sizeof(modules[count].path), "%s", path);
+            __atomic_store_n(&header->module_count, count + 1, __ATOMIC_RELEASE);
+            return count;
+        }
+    };
+
+    RegistryMirror registry_mirror;
+
+    #define REGISTRY_MIRROR_WRITE(idx, block, size, site, generation) registry_mirror.write(idx, block, size, site, generation)
+    #define REGISTRY_MIRROR_MOVE(from, to) registry_mirror.move(from, to)
+    #define REGISTRY_MIRROR_COUNT(n) registry_mirror.count(n)
+    #define REGISTRY_MIRROR_SITE(id, frames, frame_count) registry_mirror.site(id, frames, frame_count)
+#else
+    #define REGISTRY_MIRROR_WRITE(idx, block, size, site, generation) ;
+    #define REGISTRY_MIRROR_MOVE(from, to) ;
+    #define REGISTRY_MIRROR_COUNT(n) ;
+    #define REGISTRY_MIRROR_SITE(id, frames, frame_count) ;
+#endif
+
+
+#ifdef EASYSPOT_DEBUG
+
+    /// Deduplicated allocation stacks, a record only keeps the id (index + 1, 0 is unknown).
+    /// Without `EASYSPOT_ALLOC_STACKS` a site is just the caller of the block constructor,
+    /// a full backtrace costs about a microsecond per allocation
+    struct AllocSite
+    {
+        void* frames[ALLOC_SITE_FRAMES];
+        int frame_count;
+    };
+
+    std::vector<AllocSite> alloc_sites;
+    std::unordered_map<uint64_t, uint32_t> alloc_site_ids;
+    std::mutex alloc_sites_lock;
+
+    uint32_t capture_alloc_site(void* caller)
+    {
+        AllocSite site;
+        #ifdef EASYSPOT_ALLOC_STACKS
+            site.frame_count = backtrace(site.frames, ALLOC_SITE_FRAMES);
+        #else
+            site.frames[0] = caller;
+            site.frame_count = 1;
+        #endif
+
+        uint64_t hash = 14695981039346656037ull;
+        for (auto i = 0; i < site.frame_count; i++)
+            hash = (hash ^ (uint64_t)site.frames[i]) * 1099511628211ull;
+
+        std::lock_guard<std::mutex> guard(alloc_sites_lock);
+        auto [it, inserted] = alloc_site_ids.try_emplace(hash, (uint32_t)alloc_sites.size() + 1);
+        if (inserted)
+        {
+            alloc_sites.push_back(site);
+            REGISTRY_MIRROR_SITE(it->second, site.frames, site.frame_count);
+        }
+
+        return it->second;
+    }
+
+    void print_alloc_site(uint32_t id)
+    {
+        AllocSite site;
+        {
+            std::lock_guard<std::mutex> guard(alloc_sites_lock);
+            if (id == 0 || id > alloc_sites.size())
+            {
+                std::cout << " ↳ <unknown allocation site>\n";
+                return;
+            }
+
+            site = alloc_sites[id - 1];
+        }
+
+        // print_frames skips the innermost frame, which is only noise for a live stacktrace
+        if (site.frame_count == 1)
+            std::cout << " ↳ " << describe_site(site.frames[0]) << "\n";
+        else
+            print_frames(site.frames, site.frame_count);
+    }
+
+    /// Live blocks as parallel arrays, a record is the same index in each. Lookups only scan `blocks`,
+    /// a snapshot only copies the arrays it needs
+    struct Registry
+    {
+        std::vector<OwningPointer> blocks;
+        // usable size, what `block_size_of` said when the block was created or last resized
+        std::vector<size_t> sizes;
+        std::vector<uint16_t> generations;
+        // kernel id of the only thread allowed to use the block, or `NO_OWNER`
+        std::vector<uint32_t> owners;
+        // id of the allocation stack, see `capture_alloc_site`
+        std::vector<uint32_t> sites;
+
+        size_t size() const
+        {
+            return blocks.size();
+        }
+
+        /// Index of the live block at `bptr`, `size()` when there is none
+        size_t find(OwningPointer bptr) const
+        {
+            return std::find(blocks.begin(), blocks.end(), bptr) - blocks.begin();
+        }
+
+        void push(OwningPointer block, size_t size, uint16_t generation, uint32_t site)
+        {
+            blocks.push_back(block);
+            sizes.push_back(size);
+            generations.push_back(generation);
+            owners.push_back(NO_OWNER);
+            sites.push_back(site);
+        }
+
+        /// The last record takes the place of the removed one
+        void swap_remove(size_t idx)
+        {
+            blocks[idx] = blocks.back();
+            sizes[idx] = sizes.back();
+            generations[idx] = generations.back();
+            owners[idx] = owners.back();
+            sites[idx] = sites.back();
+
+            blocks.pop_back();
+            sizes.pop_back();
+            generations.pop_back();
+            owners.pop_back();
+            sites.pop_back();
+        }
+    };
+
+    // TODO: implement pointer flagging for local generation
+    // TODO: implement last access tick to track elapsed time between last block access and block drop
+    Registry debug_mem_registry;
+    std::mutex debug_mem_registry_lock;
+
+    /// Every new block takes the next generation, so a block reusing the address
+    /// of a dropped one is still told apart from it (until the counter wraps)
+    uint16_t next_generation = 1;
+
+    /// Generation of the live block at `bptr`, 0 when there is none
+    inline uint16_t generation_of(OwningPointer bptr)
+    {
+        std::lock_guard<std::mutex> guard(debug_mem_registry_lock);
+        auto idx = debug_mem_registry.find(bptr);
+        return idx < debug_mem_registry.size() ? debug_mem_registry.generations[idx] : 0;
+    }
+
+    /// Panics when the block belongs to a thread other than the caller
+    inline void check_owner(uint32_t owner, cstring what)
+    {
+        if (owner != NO_OWNER && owner != current_thread_id())
+        {
+            LOG("Error: " << what << " of a block owned by thread " << owner << " from thread " << current_thread_id());
+            panic();
+        }
+    }
+
+    namespace es
+    {
+        /// Live blocks at one point, only what `diff` needs: the allocation site and size of each
+        struct heap_snapshot
+        {
+            std::vector<uint32_t> sites;
+            std::vector<size_t> sizes;
+        };
+
+        struct site_growth
+        {
+            // id of the allocation stack, see `capture_alloc_site`
+            uint32_t site;
+            // net change between the snapshots, negative when the site shrank
+            int64_t count;
+            int64_t bytes;
+        };
+
+        /// Copies two registry arrays under the lock, the grouping by site is left to `diff`
+        heap_snapshot snapshot()
+        {
+            std::lock_guard<std::mutex> guard(debug_mem_registry_lock);
+            return heap_snapshot { .sites = debug_mem_registry.sites, .sizes = debug_mem_registry.sizes };
+        }
+
+        /// Net growth per allocation site from `before` to `after`, the largest growth in bytes first.
+        /// Sites with as many blocks and bytes in both are left out
+        std::vector<site_growth> diff(heap_snapshot const& before, heap_snapshot const& after)
+        {
+            std::unordered_map<uint32_t, site_growth> by_site;
+            for (size_t i = 0; i < after.sites.size(); i++)
+            {
+                auto& g = by_site.try_emplace(after.sites[i], site_growth { .site = after.sites[i] }).first->second;
+                g.count++;
+                g.bytes += after.sizes[i];
+            }
+
+            for (size_t i = 0; i < before.sites.size(); i++)
+            {
+                auto& g = by_site.try_emplace(before.sites[i], site_growth { .site = before.sites[i] }).first->second;
+                g.count--;
+                g.bytes -= before.sizes[i];
+            }
+
+            std::vector<site_growth> growth;
+            for (auto& [_, g] : by_site)
+                if (g.count != 0 || g.bytes != 0)
+                    growth.push_back(g);
+
+            std::sort(growth.begin(), growth.end(), [](auto& a, auto& b) { return a.bytes > b.bytes; });
+            return growth;
+        }
+
+        /// Prints every site that grew with its stack, shrinking sites are only counted
+        void print_growth(std::vector<site_growth> const& growth)
+        {
+            auto shrunk = 0;
+            for (auto& g : growth)
+            {
+                if (g.bytes <= 0 && g.count <= 0)
+                {
+                    shrunk++;
+                    continue;
+                }
+
+                std::cout << "\n[easyspot] " << g.bytes << " bytes in " << g.count << " blocks more, allocated at:\n";
+                print_alloc_site(g.site);
+            }
+
+            std::cout << "\n[easyspot] " << growth.size() - shrunk << " sites grew, " << shrunk << " shrank\n" << std::flush;
+        }
+    }
+#endif
+
+
+// false sharing detection, a sample of the accesses through refs records which thread touched which
+// bytes of each 64 bytes line. lines touched by more than one thread, with byte ranges that don't
+// overlap and at least one of them written, are false sharing: the threads fight for the line without
+// sharing any data. a non const deref only counts as a write once its bytes are seen changed
+#ifdef EASYSPOT_FALSE_SHARING
+    #ifndef EASYSPOT_DEBUG
+        #error "EASYSPOT_FALSE_SHARING needs EASYSPOT_DEBUG, blocks are found through the registry"
+    #endif
+
+    #ifndef EASYSPOT_FALSE_SHARING_PERIOD
+        // one access out of this many is recorded, per thread
+        #define EASYSPOT_FALSE_SHARING_PERIOD 16
+    #endif
+
+    constexpr int LINE_MAX_WRITERS = 4;
+
+    /// Byte range [lo, hi) of the line touched by each thread, threads past the max are ignored.
+    /// The last non const deref of a thread keeps a copy of its bytes until they are compared again
+    struct LineAccesses
+    {
+        uint32_t threads[LINE_MAX_WRITERS];
+        uint8_t lo[LINE_MAX_WRITERS];
+        uint8_t hi[LINE_MAX_WRITERS];
+        bool wrote[LINE_MAX_WRITERS];
+        uint8_t pending_lo[LINE_MAX_WRITERS];
+        uint8_t pending_hi[LINE_MAX_WRITERS];
+        uint8_t pending_bytes[LINE_MAX_WRITERS][CACHE_LINE];
+        int count = 0;
+
+        /// The pending deref of thread `i` wrote if its bytes changed since
+        void resolve(uintptr_t line, int i)
+        {
+            auto length = pending_hi[i] - pending_lo[i];
+            if (length > 0 && memcmp(pending_bytes[i], (void*)(line + pending_lo[i]), length) != 0)
+                wrote[i] = true;
+
+            pending_lo[i] = pending_hi[i] = 0;
+        }
+    };
+
+    std::unordered_map<uintptr_t, LineAccesses> sampled_lines;
+    std::mutex sampled_lines_lock;
+    static thread_local uint32_t accesses_until_sample = 1;
+
+    inline void false_sharing_sample(void* ptr, size_t size, bool is_write)
+    {
+        if (--accesses_until_sample != 0)
+            return;
+
+        accesses_until_sample = EASYSPOT_FALSE_SHARING_PERIOD;
+        auto thread = current_thread_id();
+        auto first = (uintptr_t)ptr;
+        auto last = first + size;
+
+        std::lock_guard<std::mutex> guard(sampled_lines_lock);
+        for (auto line = first & ~(CACHE_LINE - 1); line < last; line += CACHE_LINE)
+        {
+            auto lo = (uint8_t)(std::max(first, line) - line);
+            auto hi = (uint8_t)(std::min(last, line + CACHE_LINE) - line);
+            auto& a = sampled_lines[line];
+
+            auto i = 0;
+            while (i < a.count && a.threads[i] != thread)
+                i++;
+
+            if (i == a.count)
+            {
+                if (a.count == LINE_MAX_WRITERS)
+                    continue;
+
+                a.threads[i] = thread;
+                a.lo[i] = lo;
+                a.hi[i] = hi;
+                a.wrote[i] = false;
+                a.pending_lo[i] = a.pending_hi[i] = 0;
+                a.count++;
+            }
+            else
+            {
+                a.resolve(line, i);
+                a.lo[i] = std::min(a.lo[i], lo);
+                a.hi[i] = std::max(a.hi[i], hi);
+            }
+
+            if (is_write)
+                a.wrote[i] = true;
+            else
+            {
+                a.pending_lo[i] = lo;
+                a.pending_hi[i] = hi;
+                memcpy(a.pending_bytes[i], (void*)(line + lo), hi - lo);
+            }
+        }
+    }
+
+    /// Lines of a dropped block are forgotten, the memory may be reused by unrelated data
+    inline void false_sharing_forget(void* ptr, size_t size)
+    {
+        auto first = (uintptr_t)ptr & ~(CACHE_LINE - 1);
+        std::lock_guard<std::mutex> guard(sampled_lines_lock);
+
+        for (auto line = first; line < (uintptr_t)ptr + size; line += CACHE_LINE)
+            sampled_lines.erase(line);
+    }
+
+    /// Prints every falsely shared line with its block, the allocation site and the offsets each thread touched
+    void false_sharing_report()
+    {
+        std::lock_guard<std::mutex> lines_guard(sampled_lines_lock);
+        std::lock_guard<std::mutex> registry_guard(debug_mem_registry_lock);
+        auto found = 0;
+
+        for (auto& [line, a] : sampled_lines)
+        {
+            // any two threads overlapping means the data is really shared, that's a different problem
+            auto disjoint = a.count > 1;
+            for (auto i = 0; i < a.count && disjoint; i++)
+                for (auto j = i + 1; j < a.count && disjoint; j++)
+                    disjoint = a.hi[i] <= a.lo[j] || a.hi[j] <= a.lo[i];
+
+            // a line only read stays shared by every core, it costs nothing
+            auto written = false;
+            for (auto i = 0; i < a.count; i++)
+            {
+                a.resolve(line, i);
+                written = written || a.wrote[i];
+            }
+
+            if (!disjoint || !written)
+                continue;
+
+            auto& r = debug_mem_registry;
+            size_t idx = 0;
+            while (idx < r.size() && !(line + CACHE_LINE > (uintptr_t)r.blocks[idx] && line < (uintptr_t)r.blocks[idx] + r.sizes[idx]))
+                idx++;
+
+            if (idx == r.size())
+                continue;
+
+            found++;
+            auto line_offset = (intptr_t)line - (intptr_t)r.blocks[idx];
+            std::cout
+                << "\n[easyspot] False sharing in block " << (void*)r.blocks[idx]
+                << " (" << r.sizes[idx] << " bytes), cache line at offset " << line_offset << "\n";
+
+            for (auto i = 0; i < a.count; i++)
+                std::cout
+                    << " ↳ thread " << a.threads[i] << (a.wrote[i] ? " writes" : " reads") << " bytes ["
+                    << line_offset + a.lo[i] << ", " << line_offset + a.hi[i] << ")\n";
+
+            std::cout << "Allocated at:\n";
+            print_alloc_site(r.sites[idx]);
+        }
+
+        std::cout << "\n[easyspot] " << found << " falsely shared lines\n" << std::flush;
+    }
+
+    #define FALSE_SHARING_SAMPLE(ptr, size, is_write) false_sharing_sample(ptr, size, is_write)
+    #define FALSE_SHARING_FORGET(ptr, size) false_sharing_forget(ptr, size)
+#else
+    #define FALSE_SHARING_SAMPLE(ptr, size, is_write) ;
+    #define FALSE_SHARING_FORGET(ptr, size) ;
+#endif
+
+
+/// A non-owning pointer (it has not clue about the size of the pointed block)
+template<typename PointeeT>
+struct ref
+{
+    PointeeT* bptr;
+
+    ref(uint8_t* ptr)
+    {
+        bptr = (PointeeT*)ptr;
+    }
+    
+    /// A non const deref may read or write, the race and false sharing detectors only count it as a
+    /// write once they see the bytes changed. `get` and `set` say which one it is
+    PointeeT& operator*()
+    {
+        check_use();
+        TRACE_USE(bptr);
+        RACE_CHECK(bptr, sizeof(PointeeT), RACE_MAYBE_WRITE);
+        FALSE_SHARING_SAMPLE(bptr, sizeof(PointeeT), false);
+        return *bptr;
+    }
+    
+    PointeeT* operator->()
+    {
+        check_use();
+        TRACE_USE(bptr);
+        RACE_CHECK(bptr, sizeof(PointeeT), RACE_MAYBE_WRITE);
+        FALSE_SHARING_SAMPLE(bptr, sizeof(PointeeT), false);
+        return bptr;
+    }
+
+    PointeeT const& operator*() const
+    {
+        check_use();
+        TRACE_USE(bptr);
+        RACE_CHECK(bptr, sizeof(PointeeT), RACE_READ);
+        return *bptr;
+    }
+
+    PointeeT const* operator->() const
+    {
+        check_use();
+        TRACE_USE(bptr);
+        RACE_CHECK(bptr, sizeof(PointeeT), RACE_READ);
+        return bptr;
+    }
+
+    /// Read only access, never taken for a write
+    PointeeT const& get() const
+    {
+        return **this;
+    }
+
+    void set(PointeeT const& value)
+    {
+        check_use();
+        TRACE_USE(bptr);
+        RACE_CHECK(bptr, sizeof(PointeeT), RACE_WRITE);
+        FALSE_SHARING_SAMPLE(bptr, sizeof(PointeeT), true);
+        *bptr = value;
+    }
+
+    #ifdef EASYSPOT_DEBUG
+        inline void check_use() const
+        {
+            std::lock_guard<std::mutex> guard(debug_mem_registry_lock);
+            auto& r = debug_mem_registry;
+            for (size_t i = 0; i < r.size(); i++)
+            {
+                if ((uint8_t*)bptr >= r.blocks[i] && (uint8_t*)bptr <= r.blocks[i] + r.sizes[i])
+                {
+                    check_owner(r.owners[i], "Use");
+                    return;
+                }
+            }
+
+            PANIC("Use of dead reference");
+        }
+    #else
+        inline void check_use() const
+        {
+
+        }
+    #endif
+};
+
+
+/// Tag of the constructors that return zeroed memory
+struct zeroed_t {};
+constexpr zeroed_t zeroed {};
+
+/// Tag of the constructors that load a file written by `seq::save`
+struct saved_t {};
+constexpr saved_t saved {};
+
+
+// the allocation site of a block is the return address of its constructor, so in debug mode the
+// constructors stay real calls, and the ones of seq and vec are inlined into the code that calls them
+#ifdef EASYSPOT_DEBUG
+    #define BLOCK_SITE_CALL __attribute__((noinline))
+#else
+    #define BLOCK_SITE_CALL
+#endif
+
+#define CALLER_SITE __attribute__((always_inline))
+
+
+/// Untyped owning pointer
+/// contains the actual pointer to the block and the size of the block
+struct block
+{
+    OwningPointer bptr;
+
+    BLOCK_SITE_CALL block(size_t size)
+    {
+        bptr = block_create(size, 1);
+        attach(size);
+    }
+
+    /// `bptr` is aligned to `align` (a power of two)
+    BLOCK_SITE_CALL block(size_t size, size_t align)
+    {
+        bptr = block_create(size, align);
+        attach(size);
+    }
+
+    /// Starts zeroed, large blocks get it for free from fresh pages instead of a memset
+    BLOCK_SITE_CALL block(size_t size, zeroed_t, size_t align = 1)
+    {
+        bptr = block_create_zeroed(size, align);
+        attach(size);
+    }
+
+    /// Backed by the file at `path`, see `block_create_mapped`. `drop()` unmaps it, a resize moves it to the heap
+    BLOCK_SITE_CALL block(cstring path, map_mode mode)
+    {
+        bptr = block_create_mapped(path, mode);
+        attach(size());
+    }
+
+    /// The elements of a file written by `seq::save`, mapped like a file-backed block
+    BLOCK_SITE_CALL block(cstring path, saved_t, size_t element_size, map_mode mode)
+    {
+        bptr = block_create_saved(path, element_size, mode);
+        attach(size());
+    }
+
+    /// The memory belongs to `a` and is released by `a.reset()`, `drop()` only retires the block
+    BLOCK_SITE_CALL block(size_t size, arena& a)
+    {
+        bptr = block_create_in(a, size);
+        attach(size);
+    }
+
+    ~block()
+    {
+        // not allowed to deallocate internal block
+    }
+
+    __attribute__((always_inline)) inline void attach(size_t size)
+    {
+        stats_alloc(block_size_of(bptr));
+        #ifdef EASYSPOT_DEBUG
+            auto site = capture_alloc_site(__builtin_return_address(0));
+            std::lock_guard<std::mutex> guard(debug_mem_registry_lock);
+            debug_mem_registry.push(bptr, block_size_of(bptr), next_generation++, site);
+            if (next_generation == 0)
+                next_generation = 1;
+
+            REGISTRY_MIRROR_WRITE(debug_mem_registry.size() - 1, bptr, size, site, debug_mem_registry.generations.back());
+            REGISTRY_MIRROR_COUNT(debug_mem_registry.size());
+        #endif
+
+        TRACE(TRACE_ALLOC, bptr, size);
+    }
+
+    void drop()
+    {
+        check_drop();
+        auto bytes = size();
+        TRACE(TRACE_DROP, bptr, bytes);
+        RACE_FORGET(bptr, bytes);
+        FALSE_SHARING_FORGET(bptr, bytes);
+        block_destroy(bptr);
+        stats_drop(bytes);
+    }
+
+    #ifdef EASYSPOT_DEBUG
+        inline void check_drop()
+        {
+            std::lock_guard<std::mutex> guard(debug_mem_registry_lock);
+            auto i = debug_mem_registry.find(bptr);
+            if (i == debug_mem_registry.size())
+                PANIC("Drop of dead block. Maybe double drop?");
+
+            check_owner(debug_mem_registry.owners[i], "Drop");
+            debug_mem_registry.swap_remove(i);
+
+            // moved before the count goes down, so a crash in between never shows the dropped block as live
+            REGISTRY_MIRROR_MOVE(debug_mem_registry.size(), i);
+            REGISTRY_MIRROR_COUNT(debug_mem_registry.size());
+        }
+    #else
+        inline void check_drop()
+        {
+            
+        }
+    #endif
+
+    /// Grows or shrinks the block keeping its first bytes, `bptr` may change.
+    /// In debug mode the record moves to the new address with a new generation in one step,
+    /// so refs and slices taken before are reported as stale
+    void resize(size_t new_size)
+    {
+        auto old_bptr = bptr;
+        auto old_size = size();
+
+        #ifdef EASYSPOT_DEBUG
+            std::lock_guard<std::mutex> guard(debug_mem_registry_lock);
+            auto& r = debug_mem_registry;
+            auto idx = r.find(bptr);
+            if (idx == r.size())
+                PANIC("Resize of dead block");
+
+            check_owner(r.owners[idx], "Resize");
+        #endif
+
+        bptr = block_recreate(bptr, new_size);
+        stats_resize(old_size, size());
+
+        #ifdef EASYSPOT_DEBUG
+            r.blocks[idx] = bptr;
+            r.sizes[idx] = block_size_of(bptr);
+            r.generations[idx] = next_generation++;
+            if (next_generation == 0)
+                next_generation = 1;
+
+            REGISTRY_MIRROR_WRITE(idx, bptr, new_size, r.sites[idx], r.generations[idx]);
+        #endif
+
+        TRACE(TRACE_DROP, old_bptr, old_size);
+        TRACE(TRACE_ALLOC, bptr, new_size);
+
+        if (bptr != old_bptr)
+        {
+            RACE_FORGET(old_bptr, old_size);
+            FALSE_SHARING_FORGET(old_bptr, old_size);
+        }
+    }
+
+    /// From now on only the calling thread may use or drop the block, checked in debug mode
+    void make_thread_local()
+    {
+        set_owner(current_thread_id());
+    }
+
+    /// Moves the ownership to `thread` (its `current_thread_id()`), the caller must be the current owner
+    void hand_off(uint32_t thread)
+    {
+        set_owner(thread);
+    }
+
+    /// Any thread may use the block again
+    void share()
+    {
+        set_owner(NO_OWNER);
+    }
+
+    #ifdef EASYSPOT_DEBUG
+        inline void set_owner(uint32_t owner)
+        {
+            std::lock_guard<std::mutex> guard(debug_mem_registry_lock);
+            auto idx = debug_mem_registry.find(bptr);
+            if (idx == debug_mem_registry.size())
+                PANIC("Change of ownership of dead block");
+
+            check_owner(debug_mem_registry.owners[idx], "Change of ownership");
+            debug_mem_registry.owners[idx] = owner;
+        }
+    #else
+        inline void set_owner(uint32_t owner)
+        {
+
+        }
+    #endif
+
+    size_t size()
+    {
+        return block_size_of(bptr);
+    }
+
+    template<typename PointeeT>
+    ref<PointeeT> as_ref()
+    {
+        return ref<PointeeT>(bptr);
+    }
+};
+
+
+template<typename PointeeT>
+struct slice;
+
+
+#ifdef EASYSPOT_DEBUG
+    /// Iterator of seq and slice, it carries the bounds of the range it was taken from
+    /// and panics when dereferenced outside of them. Liveness is checked once by `begin()`
+    template<typename PointeeT>
+    struct checked_iter
+    {
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = PointeeT;
+        using difference_type = ptrdiff_t;
+        using pointer = PointeeT*;
+        using reference = PointeeT&;
+
+        PointeeT* ptr;
+        PointeeT* lo;
+        PointeeT* hi;
+
+        PointeeT& operator*() const
+        {
+            ASSERTM(ptr >= lo && ptr < hi, "Iterator out of bounds");
+            return *ptr;
+        }
+
+        PointeeT* operator->() const
+        {
+            ASSERTM(ptr >= lo && ptr < hi, "Iterator out of bounds");
+            return ptr;
+        }
+
+        PointeeT& operator[](ptrdiff_t n) const
+        {
+            return *(*this + n);
+        }
+
+        checked_iter& operator++() { ptr++; return *this; }
+        checked_iter& operator--() { ptr--; return *this; }
+        checked_iter operator++(int) { auto old = *this; ptr++; return old; }
+        checked_iter operator--(int) { auto old = *this; ptr--; return old; }
+        checked_iter& operator+=(ptrdiff_t n) { ptr += n; return *this; }
+        checked_iter& operator-=(ptrdiff_t n) { ptr -= n; return *this; }
+        checked_iter operator+(ptrdiff_t n) const { auto r = *this; r.ptr += n; return r; }
+        checked_iter operator-(ptrdiff_t n) const { auto r = *this; r.ptr -= n; return r; }
+        ptrdiff_t operator-(checked_iter const& other) const { return ptr - other.ptr; }
+        bool operator==(checked_iter const& other) const { return ptr == other.ptr; }
+        bool operator!=(checked_iter const& other) const { return ptr != other.ptr; }
+        bool operator<(checked_iter const& other) const { return ptr < other.ptr; }
+        bool operator<=(checked_iter const& other) const { return ptr <= other.ptr; }
+        bool operator>(checked_iter const& other) const { return ptr > other.ptr; }
+        bool operator>=(checked_iter const& other) const { return ptr >= other.ptr; }
+    };
+
+    template<typename PointeeT>
+    inline checked_iter<PointeeT> make_iter(PointeeT* ptr, PointeeT* lo, PointeeT* hi)
+    {
+        return checked_iter<PointeeT> { .ptr = ptr, .lo = lo, .hi = hi };
+    }
+#else
+    /// Plain pointers in release mode, so loops over seq and slice vectorize like loops over arrays
+    template<typename PointeeT>
+    using checked_iter = PointeeT*;
+
+    template<typename PointeeT>
+    inline PointeeT* make_iter(PointeeT* ptr, PointeeT*, PointeeT*)
+    {
+        return ptr;
+    }
+#endif
+
+
+/// Typed owning pointer that holds a sequence of concrete elements
+template<typename PointeeT>
+struct seq
+{
+    block b;
+    // the block may be bigger than asked, headerless blocks only know their size class
+    size_t count;
+
+    /// Elements are aligned to `alignof(PointeeT)`, a bigger `align` like `CACHE_LINE` can be asked
+    CALLER_SITE seq(size_t capacity, size_t align = alignof(PointeeT)) : b(capacity * sizeof(PointeeT), align), count(capacity)
+    {
+
+    }
+
+    /// Every element starts as zero bytes
+    CALLER_SITE seq(size_t capacity, zeroed_t, size_t align = alignof(PointeeT)) : b(capacity * sizeof(PointeeT), zeroed, align), count(capacity)
+    {
+
+    }
+
+    /// The elements are the file at `path`, mapped in O(1) instead of read. Bytes past the last whole element are left out
+    CALLER_SITE seq(cstring path, map_mode mode) : b(path, mode)
+    {
+        count = b.size() / sizeof(PointeeT);
+    }
+
+    /// Loads a file written by `save` in O(1), the elements are mapped, not parsed.
+    /// Writes to a `read_write` one go to the file, its checksum is brought up to date when the block is dropped
+    CALLER_SITE seq(cstring path, saved_t, map_mode mode = map_mode::read_only) : b(path, saved, sizeof(PointeeT), mode)
+    {
+        static_assert(std::is_trivially_copyable_v<PointeeT>, "only trivially copyable elements can be loaded as bytes");
+        count = b.size() / sizeof(PointeeT);
+    }
+
+    ~seq()
+    {
+        // not allowed to deallocate internal block
+    }
+
+    PointeeT& operator[](size_t idx)
+    {
+        ASSERTM(idx < count, "Index out of bounds");
+        return ((PointeeT*)b.bptr)[idx];
+    }
+
+    /// The count asked at creation, not what the block rounded it up to
+    size_t capacity()
+    {
+        return count;
+    }
+
+    ref<PointeeT> nth(size_t idx)
+    {
+        ASSERTM(idx < capacity(), "Index out of bounds");
+        return ref<PointeeT>(b.bptr + idx * sizeof(PointeeT));
+    }
+
+    /// Liveness of the block is checked once here, not on each step
+    checked_iter<PointeeT> begin()
+    {
+        check_use();
+        auto first = (PointeeT*)b.bptr;
+        return make_iter(first, first, first + capacity());
+    }
+
+    checked_iter<PointeeT> end()
+    {
+        auto first = (PointeeT*)b.bptr;
+        return make_iter(first + capacity(), first, first + capacity());
+    }
+
+    /// Checks bounds and liveness of [lo, hi) once, then calls `fn(first, count)` with a raw pointer,
+    /// so the loop in `fn` has nothing left that stops the compiler from vectorizing it
+    template<typename SpanF>
+    void with_span(size_t lo, size_t hi, SpanF fn)
+    {
+        ASSERTM(lo <= hi && hi <= capacity(), "Span out of bounds");
+        check_use();
+        fn((PointeeT*)b.bptr + lo, hi - lo);
+    }
+
+    inline void check_use()
+    {
+        ref<PointeeT>(b.bptr).check_use();
+    }
+
+    /// Elements [lo, hi) as a view, nothing is copied
+    slice<PointeeT> sub(size_t lo, size_t hi)
+    {
+        ASSERTM(lo <= hi && hi <= capacity(), "Slice out of bounds");
+        return slice<PointeeT>(b.bptr, (PointeeT*)b.bptr + lo, hi - lo);
+    }
+
+    slice<PointeeT> as_slice()
+    {
+        return sub(0, capacity());
+    }
+
+    /// All the elements in one write, in a format `seq(path, saved)` maps back. It replaces `path` atomically
+    void save(cstring path)
+    {
+        static_assert(std::is_trivially_copyable_v<PointeeT>, "only trivially copyable elements can be saved as bytes");
+        check_use();
+        save_elements(path, b.bptr, sizeof(PointeeT), capacity());
+    }
+
+    void drop()
+    {
+        b.drop();
+    }
+};
+
+
+/// Growable sequence, `size()` elements are in use out of `capacity()`.
+/// Elements are moved as bytes when the block grows, so they must be trivially copyable.
+/// Small vecs grow through the pool size classes (with `EASYSPOT_POOL`), large ones are remapped in place
+template<typename PointeeT>
+struct vec
+{
+    static_assert(std::is_trivially_copyable_v<PointeeT>, "vec moves its elements as bytes");
+
+    block b;
+    size_t len;
+
+    CALLER_SITE vec(size_t capacity = 0, size_t align = alignof(PointeeT)) : b(capacity * sizeof(PointeeT), align), len(0)
+    {
+
+    }
+
+    ~vec()
+    {
+        // not allowed to deallocate internal block
+    }
+
+    PointeeT& operator[](size_t idx)
+    {
+        ASSERTM(idx < len, "Index out of bounds");
+        return ((PointeeT*)b.bptr)[idx];
+    }
+
+    size_t size()
+    {
+        return len;
+    }
+
+    size_t capacity()
+    {
+        return b.size() / sizeof(PointeeT);
+    }
+
+    ref<PointeeT> nth(size_t idx)
+    {
+        ASSERTM(idx < len, "Index out of bounds");
+        return ref<PointeeT>(b.bptr + idx * sizeof(PointeeT));
+    }
+
+    /// Amortized O(1), the capacity doubles when full
+    void push(PointeeT const& value)
+    {
+        if (len == capacity())
+        {
+            // `value` may be an element, which the growth moves away
+            auto copy = value;
+            reserve(std::max<size_t>(4, capacity() * 2));
+            ((PointeeT*)b.bptr)[len++] = copy;
+            return;
+        }
+
+        ((PointeeT*)b.bptr)[len++] = value;
+    }
+
+    void reserve(size_t capacity)
+    {
+        if (capacity > this->capacity())
+            b.resize(capacity * sizeof(PointeeT));
+    }
+
+    /// New elements are zeroed
+    void resize(size_t size)
+    {
+        reserve(size);
+        if (size > len)
+            memset((PointeeT*)b.bptr + len, 0, (size - len) * sizeof(PointeeT));
+
+        len = size;
+    }
+
+    checked_iter<PointeeT> begin()
+    {
+        ref<PointeeT>(b.bptr).check_use();
+        auto first = (PointeeT*)b.bptr;
+        return make_iter(first, first, first + len);
+    }
+
+    checked_iter<PointeeT> end()
+    {
+        auto first = (PointeeT*)b.bptr;
+        return make_iter(first + len, first, first + len);
+    }
+
+    /// Same as `seq::with_span`, bounded by `size()`
+    template<typename SpanF>
+    void with_span(size_t lo, size_t hi, SpanF fn)
+    {
+        ASSERTM(lo <= hi && hi <= len, "Span out of bounds");
+        ref<PointeeT>(b.bptr).check_use();
+        fn((PointeeT*)b.bptr + lo, hi - lo);
+    }
+
+    void drop()
+    {
+        b.drop();
+    }
+};
+
+
+/// Just like `block` has `ref`, so does `seq` with `slice`.
+/// A non-owning view of `len` elements of a seq, copying it never copies the elements.
+/// In debug mode it remembers the generation of the parent block, so iterating it after the
+/// parent is dropped is caught even when a new block took the same address.
+/// Like `seq`, indexing only checks bounds, a registry lookup per element is too slow
+template<typename PointeeT>
+struct slice
 {
-    uint8_t* bptr;
+    PointeeT* bptr;
+    size_t len;
+
+    #ifdef EASYSPOT_DEBUG
+        OwningPointer parent;
+        uint16_t generation;
+    #endif
+
+    slice(OwningPointer parent, PointeeT* ptr, size_t len) : bptr(ptr), len(len)
+    {
+        #ifdef EASYSPOT_DEBUG
+            this->parent = parent;
+            generation = generation_of(parent);
+        #endif
+    }
+
+    PointeeT& operator[](size_t idx)
+    {
+        ASSERTM(idx < len, "Index out of bounds");
+        return bptr[idx];
+    }
 
-    // TODO: implement this
+    size_t length()
+    {
+        return len;
+    }
+
+    ref<PointeeT> nth(size_t idx)
+    {
+        ASSERTM(idx < len, "Index out of bounds");
+        return ref<PointeeT>((uint8_t*)(bptr + idx));
+    }
+
+    /// Elements [lo, hi) of this slice, still pointing in the same parent
+    slice sub(size_t lo, size_t hi)
+    {
+        ASSERTM(lo <= hi && hi <= len, "Slice out of bounds");
+        auto result = *this;
+        result.bptr += lo;
+        result.len = hi - lo;
+        return result;
+    }
+
+    /// The parent is checked once here, not on each step
+    checked_iter<PointeeT> begin()
+    {
+        check_use();
+        return make_iter(bptr, bptr, bptr + len);
+    }
+
+    checked_iter<PointeeT> end()
+    {
+        return make_iter(bptr + len, bptr, bptr + len);
+    }
+
+    /// Same as `seq::with_span`, [lo, hi) is relative to the slice
+    template<typename SpanF>
+    void with_span(size_t lo, size_t hi, SpanF fn)
+    {
+        ASSERTM(lo <= hi && hi <= len, "Span out of bounds");
+        check_use();
+        fn(bptr + lo, hi - lo);
+    }
+
+    #ifdef EASYSPOT_DEBUG
+        inline void check_use()
+        {
+            if (generation != 0 && generation_of(parent) == generation)
+                return;
+
+            PANIC("Use of slice of dead block");
+        }
+    #else
+        inline void check_use()
+        {
+
+        }
+    #endif
 };
@@ -21,6 +21,25 @@ int main()
     *n = 111;
     DUMP(*n);
 
+    auto sl = s.sub(1, 4);
+    sl[0] = 222;
+    DUMP(sl.length());
+    DUMP(s[1]);
+
+    auto v = vec<int32_t>();
+    for (auto i = 0; i < 5; i++)
+        v.push(i * 10);
+    DUMP(v.size());
+    DUMP(v.capacity());
+    DUMP(v[4]);
+
+    auto z = seq<int64_t>(1 << 20, zeroed);
+    DUMP(z[123456]);
+
+    auto stats = es::heap_alloc_stats();
+    DUMP(stats.live_count);
+    DUMP(stats.peak_bytes);
+
     HERE;
     LOG("s cap = " << s.capacity());
 
@@ -33,6 +52,18 @@ int main()
     //b.drop(); b.drop();
 
     //s.drop(); *n = 0;
+    //s.drop(); for (auto& x : sl) x = 0;
+
+    //auto table = seq<int32_t>("../README.md", map_mode::read_only); table[0] = 0;
+
+    //b.make_thread_local(); std::thread([&] { *r = 0; }).join();
+
+    // with EASYSPOT_DEBUG, not an error but a slow leak
+    //auto before = es::snapshot(); auto kept = block(64); es::print_growth(es::diff(before, es::snapshot()));
+
+    // with EASYSPOT_RACE
+    //auto t = es::thread([&] { *r = 1; }); *r = 2; t.join();
+    //auto t = es::thread([&] { DUMP(r.get()); }); *r = 7; t.join();
 
     // TODO, print them all (mainly size), print number of undropped blocks
     //check_registry_for_undropped_blocks();
@@ -0,0 +1,182 @@
+// Lists the blocks that were live when a process built with `EASYSPOT_REGISTRY_MIRROR` stopped, grouped by allocation site
+// usage: registry easyspot-<pid>.registry [--symbolize] [--blocks <max per site>]
+//
+// works on the file of a crashed or killed process, frames are printed as module+offset,
+// `--symbolize` runs addr2line on them (the binaries must still be the ones that ran)
+
+#include "../../lib.hpp"
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+
+
+struct SiteGroup
+{
+    uint32_t site;
+    size_t count;
+    size_t bytes;
+    std::vector<RegistryMirrorRecord> blocks;
+};
+
+
+/// Maps the file read only and checks it was written by a compatible mirror
+RegistryMirrorHeader* load_mirror(cstring path, size_t& file_size)
+{
+    auto fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+
+    file_size = lseek(fd, 0, SEEK_END);
+    if (file_size < sizeof(RegistryMirrorHeader))
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    auto mapping = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return nullptr;
+
+    auto header = (RegistryMirrorHeader*)mapping;
+    auto valid = std::equal(header->magic, header->magic + 8, REGISTRY_MIRROR_MAGIC)
+        && header->version == REGISTRY_MIRROR_VERSION
+        && header->records_offset + header->record_capacity * sizeof(RegistryMirrorRecord) <= header->sites_offset
+        && header->sites_offset + header->site_capacity * sizeof(RegistryMirrorSite) <= header->modules_offset
+        && header->modules_offset + header->module_capacity * sizeof(RegistryMirrorModule) <= file_size
+        && header->record_count <= header->record_capacity
+        && header->module_count <= header->module_capacity;
+
+    if (!valid)
+    {
+        munmap(mapping, file_size);
+        return nullptr;
+    }
+
+    return header;
+}
+
+/// One line from addr2line, empty when it is not installed or knows nothing
+std::string symbolize(cstring module, uint64_t offset)
+{
+    char command[512];
+    // frames are return addresses, one byte back lands inside the call instruction
+    snprintf(command, sizeof(command), "addr2line -f -C -p -e '%s' 0x%lx 2>/dev/null", module, (unsigned long)(offset - 1));
+
+    auto pipe = popen(command, "r");
+    if (!pipe)
+        return "";
+
+    char line[512] = {};
+    if (!fgets(line, sizeof(line), pipe))
+        line[0] = '\0';
+
+    pclose(pipe);
+    line[strcspn(line, "\n")] = '\0';
+    return strncmp(line, "??", 2) == 0 ? "" : line;
+}
+
+void print_site(RegistryMirrorHeader* header, uint32_t id, bool symbolized)
+{
+    auto base = (uint8_t*)header;
+    auto sites = (RegistryMirrorSite*)(base + header->sites_offset);
+    auto modules = (RegistryMirrorModule*)(base + header->modules_offset);
+
+    if (id == 0 || id > header->site_capacity || sites[id - 1].frame_count == 0)
+    {
+        printf("    (unknown site)\n");
+        return;
+    }
+
+    auto& site = sites[id - 1];
+    for (uint32_t i = 0; i < std::min<uint32_t>(site.frame_count, ALLOC_SITE_FRAMES); i++)
+    {
+        if (site.modules[i] >= header->module_count)
+        {
+            printf("    #%u 0x%lx\n", i, (unsigned long)site.offsets[i]);
+            continue;
+        }
+
+        auto module = modules[site.modules[i]].path;
+        auto symbol = symbolized ? symbolize(module, site.offsets[i]) : std::string();
+        printf("    #%u %s+0x%lx %s\n", i, module, (unsigned long)site.offsets[i], symbol.c_str());
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        printf("usage: %s <registry file> [--symbolize] [--blocks <max per site>]\n", argv[0]);
+        return 1;
+    }
+
+    auto symbolized = false;
+    size_t max_blocks = 8;
+    for (auto i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--symbolize") == 0)
+            symbolized = true;
+        else if (strcmp(argv[i], "--blocks") == 0 && i + 1 < argc)
+            max_blocks = strtoull(argv[++i], nullptr, 10);
+        else
+        {
+            printf("error: unknown argument `%s`\n", argv[i]);
+            return 1;
+        }
+    }
+
+    size_t file_size = 0;
+    auto header = load_mirror(argv[1], file_size);
+    if (!header)
+    {
+        printf("error: `%s` is not a readable easyspot registry mirror\n", argv[1]);
+        return 1;
+    }
+
+    auto records = (RegistryMirrorRecord*)((uint8_t*)header + header->records_offset);
+    std::unordered_map<uint32_t, SiteGroup> by_site;
+    size_t total_bytes = 0;
+    size_t live_count = 0;
+
+    for (uint64_t i = 0; i < header->record_count; i++)
+    {
+        auto& r = records[i];
+        if (r.address == 0)
+            continue;
+
+        live_count++;
+        auto& group = by_site.try_emplace(r.site, SiteGroup { .site = r.site }).first->second;
+        group.count++;
+        group.bytes += r.size;
+        total_bytes += r.size;
+        if (group.blocks.size() < max_blocks)
+            group.blocks.push_back(r);
+    }
+
+    std::vector<SiteGroup> groups;
+    for (auto& [_, group] : by_site)
+        groups.push_back(std::move(group));
+
+    std::sort(groups.begin(), groups.end(), [](auto& a, auto& b) { return a.bytes > b.bytes; });
+
+    printf("pid %u: %zu live blocks, %zu bytes, %zu sites\n", header->pid, live_count, total_bytes, groups.size());
+    if (header->overflowed)
+        printf("warning: more than %lu blocks were live at once, the list is incomplete\n", (unsigned long)header->record_capacity);
+
+    for (auto& group : groups)
+    {
+        printf("\n%zu bytes in %zu blocks, site %u\n", group.bytes, group.count, group.site);
+        print_site(header, group.site, symbolized);
+
+        for (auto& b : group.blocks)
+            printf("      %p  %lu bytes  gen %u\n", (void*)b.address, (unsigned long)b.size, b.generation);
+
+        if (group.count > group.blocks.size())
+            printf("      ... %zu more\n", group.count - group.blocks.size());
+    }
+
+    munmap(header, file_size);
+    return 0;
+}
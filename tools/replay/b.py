@@ -0,0 +1,4 @@
+import fct
+
+#fct.use_release_build_instead()
+fct.run_argv()
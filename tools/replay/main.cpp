@@ -0,0 +1,253 @@
+// Replays the alloc/drop sequence recorded with `EASYSPOT_TRACE` against every allocator backend
+// usage: replay easyspot-<pid>-<tid>.trace [more trace files of the same process...]
+//
+// every backend runs in a forked child so peak rss and leftover mappings never leak between runs
+
+#define EASYSPOT_DEBUG
+#include "../../lib.hpp"
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <chrono>
+#include <string>
+#include <unordered_map>
+
+
+struct ReplayOp
+{
+    uint64_t size;
+    uint32_t slot;
+    bool is_alloc;
+};
+
+struct ReplayResult
+{
+    double seconds;
+    size_t peak_live_bytes;
+    size_t peak_rss_bytes;
+};
+
+
+/// Reads the events of one ring file in the order they were written
+bool load_trace(cstring path, std::vector<TraceEvent>& out)
+{
+    auto fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    auto file_size = lseek(fd, 0, SEEK_END);
+    if (file_size < (off_t)sizeof(TraceHeader))
+    {
+        close(fd);
+        return false;
+    }
+
+    auto mapping = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return false;
+
+    auto header = (TraceHeader*)mapping;
+    auto events = (TraceEvent*)(header + 1);
+    auto valid = std::equal(header->magic, header->magic + 8, TRACE_MAGIC)
+        && header->version == TRACE_VERSION
+        && header->event_size == sizeof(TraceEvent);
+
+    if (valid)
+    {
+        // once the ring wrapped only the last `capacity` events are still there
+        auto first = header->head > header->capacity ? header->head - header->capacity : 0;
+        for (auto i = first; i < header->head; i++)
+            out.push_back(events[i % header->capacity]);
+    }
+
+    munmap(mapping, file_size);
+    return valid;
+}
+
+/// Turns addresses into dense slots, drops of blocks allocated before the ring window are skipped
+std::vector<ReplayOp> build_ops(std::vector<TraceEvent>& events, uint32_t& slot_count)
+{
+    std::stable_sort(events.begin(), events.end(), [](auto& a, auto& b) { return a.tick < b.tick; });
+
+    std::vector<ReplayOp> ops;
+    std::unordered_map<uint64_t, uint32_t> live_slots;
+    slot_count = 0;
+
+    for (auto& e : events)
+    {
+        if (e.kind == TRACE_ALLOC)
+        {
+            live_slots[e.address] = slot_count;
+            ops.push_back(ReplayOp { .size = e.size, .slot = slot_count, .is_alloc = true });
+            slot_count++;
+        }
+        else if (e.kind == TRACE_DROP)
+        {
+            auto it = live_slots.find(e.address);
+            if (it == live_slots.end())
+                continue;
+
+            ops.push_back(ReplayOp { .size = e.size, .slot = it->second, .is_alloc = false });
+            live_slots.erase(it);
+        }
+    }
+
+    return ops;
+}
+
+inline uint8_t* pointer_of(void* ptr)
+{
+    return (uint8_t*)ptr;
+}
+
+inline uint8_t* pointer_of(block& b)
+{
+    return b.bptr;
+}
+
+/// `alloc(size) -> Slot` and `drop(Slot&, size)` are the backend, slots are numbered in allocation order
+template<typename AllocF, typename DropF>
+ReplayResult replay(std::vector<ReplayOp> const& ops, uint32_t slot_count, AllocF alloc, DropF drop)
+{
+    std::vector<decltype(alloc(0))> slots;
+    slots.reserve(slot_count);
+    auto base_rss = es::process_rss_bytes();
+    size_t live_bytes = 0;
+    ReplayResult result = {};
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < ops.size(); i++)
+    {
+        auto& op = ops[i];
+        if (op.is_alloc)
+        {
+            slots.push_back(alloc(op.size));
+
+            // touching the memory like the real program did, otherwise pages are never resident
+            if (op.size > 0)
+                ((volatile uint8_t*)pointer_of(slots.back()))[0] = 1;
+
+            live_bytes += op.size;
+            result.peak_live_bytes = std::max(result.peak_live_bytes, live_bytes);
+        }
+        else
+        {
+            drop(slots[op.slot], op.size);
+            live_bytes -= op.size;
+        }
+
+        // sampling rss is a syscall, doing it on every op would hide the allocator cost
+        if ((i & 4095) == 0)
+            result.peak_rss_bytes = std::max(result.peak_rss_bytes, es::process_rss_bytes());
+    }
+
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.peak_rss_bytes = std::max(result.peak_rss_bytes, es::process_rss_bytes());
+    result.peak_rss_bytes = result.peak_rss_bytes > base_rss ? result.peak_rss_bytes - base_rss : 0;
+    return result;
+}
+
+template<typename RunF>
+bool run_forked(RunF run, ReplayResult& result)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+        return false;
+
+    auto pid = fork();
+    if (pid == 0)
+    {
+        close(fds[0]);
+        auto r = run();
+        auto written = write(fds[1], &r, sizeof(r));
+        _exit(written == sizeof(r) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    auto ok = pid > 0 && read(fds[0], &result, sizeof(result)) == sizeof(result);
+    close(fds[0]);
+
+    int status = 0;
+    if (pid > 0)
+        waitpid(pid, &status, 0);
+
+    return ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+void report(cstring backend, size_t op_count, ReplayResult const& r)
+{
+    auto fragmentation = r.peak_rss_bytes > r.peak_live_bytes
+        ? 1.0 - (double)r.peak_live_bytes / r.peak_rss_bytes
+        : 0.0;
+
+    printf(
+        "%-10s %12.0f ops/s %10.1f ns/op %10.2f MiB peak rss %8.1f%% fragmentation\n",
+        backend, op_count / r.seconds, r.seconds * 1e9 / op_count,
+        r.peak_rss_bytes / (1024.0 * 1024.0), fragmentation * 100.0
+    );
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        printf("usage: %s <trace files...>\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<TraceEvent> events;
+    for (auto i = 1; i < argc; i++)
+        if (!load_trace(argv[i], events))
+        {
+            printf("error: `%s` is not a readable easyspot trace\n", argv[i]);
+            return 1;
+        }
+
+    uint32_t slot_count = 0;
+    auto ops = build_ops(events, slot_count);
+    if (ops.empty())
+    {
+        printf("error: no alloc/drop events found\n");
+        return 1;
+    }
+
+    printf("%zu ops, %u blocks\n\n", ops.size(), slot_count);
+
+    ReplayResult r;
+    if (run_forked([&]
+    {
+        return replay(ops, slot_count,
+            [](size_t size) { return (void*)new uint8_t[size]; },
+            [](void*& ptr, size_t) { delete[] (uint8_t*)ptr; });
+    }, r))
+        report("new[]", ops.size(), r);
+
+    if (run_forked([&]
+    {
+        // the child is forked, so the global pool starts empty
+        return replay(ops, slot_count,
+            [&](size_t size) { return size <= POOL_MAX_SIZE ? global_pool.alloc(size) : (void*)new uint8_t[size]; },
+            [&](void*& ptr, size_t size) { size <= POOL_MAX_SIZE ? global_pool.free(ptr, size) : delete[] (uint8_t*)ptr; });
+    }, r))
+        report("pool", ops.size(), r);
+
+    if (run_forked([&]
+    {
+        arena a;
+        return replay(ops, slot_count,
+            [&](size_t size) { return a.alloc(size); },
+            [](void*&, size_t) { });
+    }, r))
+        report("arena", ops.size(), r);
+
+    if (run_forked([&]
+    {
+        return replay(ops, slot_count,
+            [](size_t size) { return block(size); },
+            [](block& b, size_t) { b.drop(); });
+    }, r))
+        report("registry", ops.size(), r);
+
+    return 0;
+}